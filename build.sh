@@ -161,6 +161,7 @@ else
         "client")
             print_info "Building client..."
             make -f Makefile.client $MAKE_TARGET -j"$PARALLEL_JOBS"
+            make -f Makefile.lib -j"$PARALLEL_JOBS"
             ;;
         "daemon")
             print_info "Building daemon..."
@@ -176,6 +177,7 @@ else
         "both")
             print_info "Building client..."
             make -f Makefile.client $MAKE_TARGET -j"$PARALLEL_JOBS"
+            make -f Makefile.lib -j"$PARALLEL_JOBS"
             print_info "Building daemon..."
             make -f Makefile.clientd $MAKE_TARGET -j"$PARALLEL_JOBS"
             ;;
@@ -212,6 +214,7 @@ if [ "$INSTALL" = true ]; then
     case $BUILD_TARGET in
         "client")
             sudo make -f Makefile.client install
+            sudo make -f Makefile.lib install
             ;;
         "daemon")
             sudo make -f Makefile.clientd install
@@ -221,6 +224,7 @@ if [ "$INSTALL" = true ]; then
                 cd build && sudo make install && cd ..
             else
                 sudo make -f Makefile.client install
+                sudo make -f Makefile.lib install
                 sudo make -f Makefile.clientd install
             fi
             ;;
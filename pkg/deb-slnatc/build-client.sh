@@ -23,17 +23,24 @@ cd "$PROJECT_ROOT"
 # Use the client makefile
 make -f Makefile.client clean
 make -f Makefile.client
+make -f Makefile.lib shared
 
 # Build client package
 echo "Building client package..."
 CLIENT_PKG_DIR="$BUILD_DIR/slick-nat-client"
 mkdir -p "$CLIENT_PKG_DIR/DEBIAN"
 mkdir -p "$CLIENT_PKG_DIR/usr/bin"
+mkdir -p "$CLIENT_PKG_DIR/usr/lib"
+mkdir -p "$CLIENT_PKG_DIR/usr/include"
 mkdir -p "$CLIENT_PKG_DIR/usr/share/man/man1"
 mkdir -p "$CLIENT_PKG_DIR/usr/share/doc/slick-nat-client"
 
 # Copy client files
 cp build/slnatc "$CLIENT_PKG_DIR/usr/bin/"
+cp build/libslnat.so.1.0.0 "$CLIENT_PKG_DIR/usr/lib/"
+ln -sf libslnat.so.1.0.0 "$CLIENT_PKG_DIR/usr/lib/libslnat.so.1"
+ln -sf libslnat.so.1.0.0 "$CLIENT_PKG_DIR/usr/lib/libslnat.so"
+cp src-lib/slnat.h "$CLIENT_PKG_DIR/usr/include/"
 cp pkg/deb-slnatc/control "$CLIENT_PKG_DIR/DEBIAN/"
 
 # Create man page
@@ -72,7 +79,8 @@ SlickNat Client
 ===============
 
 This package contains the slnatc command-line client for querying
-SlickNat daemon about IPv6 NAT mappings.
+SlickNat daemon about IPv6 NAT mappings, and libslnat, the C client
+library it is built on (slnat.h, -lslnat).
 
 Usage:
   slnatc <daemon_address> <command> [options]
@@ -96,6 +104,7 @@ gzip -9 "$CLIENT_PKG_DIR/usr/share/man/man1/slnatc.1"
 
 # Set permissions
 chmod 755 "$CLIENT_PKG_DIR/usr/bin/slnatc"
+chmod 644 "$CLIENT_PKG_DIR/usr/lib/libslnat.so.1.0.0"
 
 # Build package
 echo "Building client .deb package..."
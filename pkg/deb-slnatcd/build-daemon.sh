@@ -38,8 +38,9 @@ mkdir -p "$DAEMON_PKG_DIR/etc/slnatcd"
 cp build/slick-nat-daemon "$DAEMON_PKG_DIR/usr/sbin/"
 cp pkg/deb-slnatcd/control "$DAEMON_PKG_DIR/DEBIAN/"
 
-# Copy systemd service file
+# Copy systemd service and socket files
 cp pkg/deb-slnatcd/res/slnatcd.service "$DAEMON_PKG_DIR/lib/systemd/system/"
+cp pkg/deb-slnatcd/res/slnatcd.socket "$DAEMON_PKG_DIR/lib/systemd/system/"
 
 # Copy default config file
 cp pkg/deb-slnatcd/res/etc-slnatd "$DAEMON_PKG_DIR/etc/slnatcd/config"
@@ -63,6 +64,12 @@ Service Management:
   sudo systemctl start slnatcd
   sudo systemctl enable slnatcd
   sudo systemctl status slnatcd
+  sudo systemctl reload slnatcd         # apply listen and log_level changes
+
+Socket Activation:
+  List the listen addresses in slnatcd.socket as well and enable it with
+  sudo systemctl enable --now slnatcd.socket to keep the sockets open
+  across daemon restarts.
 
 Logs:
   sudo journalctl -u slnatcd -f
@@ -82,7 +89,7 @@ systemctl start slnatcd || true
 
 echo "SlickNat daemon installed and started."
 echo "Configure listening addresses in /etc/slnatcd/config"
-echo "Then restart with: sudo systemctl restart slnatcd"
+echo "Then apply with: sudo systemctl reload slnatcd"
 EOF
 
 # Create pre-remove script
@@ -104,6 +111,7 @@ gzip -9 "$DAEMON_PKG_DIR/usr/share/man/man8/slick-nat-daemon.8"
 # Set permissions
 chmod 755 "$DAEMON_PKG_DIR/usr/sbin/slick-nat-daemon"
 chmod 644 "$DAEMON_PKG_DIR/lib/systemd/system/slnatcd.service"
+chmod 644 "$DAEMON_PKG_DIR/lib/systemd/system/slnatcd.socket"
 chmod 644 "$DAEMON_PKG_DIR/etc/slnatcd/config"
 chmod 755 "$DAEMON_PKG_DIR/DEBIAN/postinst"
 chmod 755 "$DAEMON_PKG_DIR/DEBIAN/prerm"
@@ -0,0 +1,293 @@
+// Microbenchmarks for the daemon's mapping table: parsing and reloading
+// synthetic proc files, prefix matching, remapping and the resolve/get2kip
+// lookups. Prints one JSON object (or CSV row) per benchmark so results can
+// be compared across releases.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <functional>
+#include <cstdlib>
+#include <sys/stat.h>
+#include "../src-clientd/slnat-table.h"
+
+using json = nlohmann::json;
+
+// Keeps the compiler from discarding benchmarked work
+static volatile uint64_t sink;
+
+struct BenchResult {
+    std::string name;
+    size_t entries;
+    uint64_t iterations;
+    double ns_per_op;
+};
+
+// Runs op in batches, doubling the batch until one takes at least
+// min_time_s, and reports the time per call of that batch
+template <typename Op>
+BenchResult time_op(const std::string& name, size_t entries, double min_time_s, Op op) {
+    uint64_t batch = 1;
+    while (true) {
+        auto started = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < batch; i++) {
+            op(i);
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        if (elapsed >= min_time_s || batch >= (1ULL << 40)) {
+            return {name, entries, batch, elapsed * 1e9 / batch};
+        }
+        uint64_t scaled = elapsed > 0 ? static_cast<uint64_t>(batch * min_time_s / elapsed * 1.1) : 0;
+        batch = std::max(batch * 2, scaled);
+    }
+}
+
+// count mappings in the kernel's proc format. Every fourth is a /64 under
+// its own /16 so the tries hold prefixes of more than one length.
+std::string synthetic_mappings(size_t count) {
+    std::string content;
+    content.reserve(count * 64);
+    char line[128];
+    for (size_t i = 0; i < count; i++) {
+        unsigned high = static_cast<unsigned>(i >> 16);
+        unsigned low = static_cast<unsigned>(i & 0xFFFF);
+        if (i % 4 == 3) {
+            snprintf(line, sizeof(line), "eth%zu fd01:%x:%x:1::/64 -> 2a01:%x:%x:1::/64\n", i % 8, high, low, high, low);
+        } else {
+            snprintf(line, sizeof(line), "eth%zu fd00:%x:%x::/48 -> 2a00:%x:%x::/48\n", i % 8, high, low, high, low);
+        }
+        content += line;
+    }
+    return content;
+}
+
+// Lookup addresses: three in four fall inside an internal prefix, one in
+// eight inside an external prefix, and the rest match nothing
+std::vector<struct in6_addr> lookup_addresses(const MappingTable& table, size_t count) {
+    std::mt19937_64 rng(42);
+    std::vector<struct in6_addr> addresses(count);
+    for (auto& addr : addresses) {
+        uint64_t random_bits[2] = {rng(), rng()};
+        memcpy(addr.s6_addr, random_bits, sizeof(addr.s6_addr));
+        
+        uint64_t kind = rng() % 8;
+        const NatMapping& mapping = table.mappings[rng() % table.mappings.size()];
+        if (kind < 6) {
+            remap_prefix(addr, mapping.internal_addr, mapping.prefix_len);
+        } else if (kind == 6) {
+            remap_prefix(addr, mapping.external_addr, mapping.prefix_len);
+        } else {
+            addr.s6_addr[0] = 0x3f;
+        }
+    }
+    return addresses;
+}
+
+bool write_file(const std::string& path, const std::string& content) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << content;
+    return file.good();
+}
+
+void print_result(const BenchResult& result, bool csv) {
+    if (csv) {
+        std::cout << result.name << "," << result.entries << "," << result.iterations << ","
+                  << result.ns_per_op << std::endl;
+        return;
+    }
+    json line = {
+        {"benchmark", result.name},
+        {"entries", result.entries},
+        {"iterations", result.iterations},
+        {"ns_per_op", result.ns_per_op}
+    };
+    std::cout << line.dump() << std::endl;
+}
+
+void print_usage(const char* program_name) {
+    std::cout << "Usage: " << program_name << " [options]\n";
+    std::cout << "Options:\n";
+    std::cout << "  --sizes N,N,...     Synthetic table sizes (default: 10,100,1000,10000,100000,1000000)\n";
+    std::cout << "  --min-time SECONDS  Minimum measured time per benchmark (default: 0.2)\n";
+    std::cout << "  --filter TEXT       Only run benchmarks whose name contains TEXT\n";
+    std::cout << "  --dir PATH          Keep the synthetic mapping files in PATH\n";
+    std::cout << "  --csv               Print CSV instead of one JSON object per line\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<size_t> sizes = {10, 100, 1000, 10000, 100000, 1000000};
+    double min_time_s = 0.2;
+    std::string filter;
+    std::string dir;
+    bool csv = false;
+    
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--sizes" && i + 1 < argc) {
+            sizes.clear();
+            std::istringstream iss(argv[++i]);
+            std::string size;
+            while (std::getline(iss, size, ',')) {
+                try {
+                    sizes.push_back(std::stoul(size));
+                } catch (const std::exception&) {
+                    std::cerr << "Error: Invalid size: " << size << std::endl;
+                    return 1;
+                }
+                if (sizes.back() == 0) {
+                    std::cerr << "Error: Sizes must be positive" << std::endl;
+                    return 1;
+                }
+            }
+        } else if (arg == "--min-time" && i + 1 < argc) {
+            try {
+                min_time_s = std::stod(argv[++i]);
+            } catch (const std::exception&) {
+                min_time_s = 0;
+            }
+            if (!(min_time_s > 0)) {
+                std::cerr << "Error: Invalid minimum time: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--dir" && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (arg == "--csv") {
+            csv = true;
+        } else {
+            print_usage(argv[0]);
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+    }
+    
+    bool keep_files = !dir.empty();
+    if (dir.empty()) {
+        char temp_dir[] = "/tmp/slnat-bench.XXXXXX";
+        if (!mkdtemp(temp_dir)) {
+            std::cerr << "Error: Cannot create a temporary directory" << std::endl;
+            return 1;
+        }
+        dir = temp_dir;
+    } else if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST) {
+        std::cerr << "Error: Cannot create " << dir << std::endl;
+        return 1;
+    }
+    
+    if (csv) {
+        std::cout << "benchmark,entries,iterations,ns_per_op" << std::endl;
+    }
+    
+    auto run = [&](const std::string& name, size_t entries, const std::function<void(uint64_t)>& op) {
+        if (filter.empty() || name.find(filter) != std::string::npos) {
+            print_result(time_op(name, entries, min_time_s, op), csv);
+        }
+    };
+    
+    // Address helpers do not depend on the table size
+    {
+        struct in6_addr addr;
+        struct in6_addr prefix;
+        inet_pton(AF_INET6, "fd00:12:3456::abcd", &addr);
+        inet_pton(AF_INET6, "fd00:12:3456::", &prefix);
+        
+        run("prefix_equal", 0, [&](uint64_t i) {
+            sink += prefix_equal(addr, prefix, 48 + (i & 7));
+        });
+        run("ip_matches_prefix", 0, [&](uint64_t) {
+            sink += ip_matches_prefix("fd00:12:3456::abcd", "fd00:12:3456::", 48);
+        });
+        run("remap_prefix", 0, [&](uint64_t i) {
+            struct in6_addr mapped = addr;
+            remap_prefix(mapped, prefix, 44 + (i & 7));
+            sink += mapped.s6_addr[5];
+        });
+        run("remap_address", 0, [&](uint64_t) {
+            sink += remap_address("fd00:12:3456::abcd", "fd00:12:3456::", "2a00:12:3456::", 48).size();
+        });
+    }
+    
+    for (size_t size : sizes) {
+        std::string path = dir + "/mappings-" + std::to_string(size);
+        std::string content = synthetic_mappings(size);
+        if (!write_file(path, content)) {
+            std::cerr << "Error: Cannot write " << path << std::endl;
+            return 1;
+        }
+        
+        // The reload path as the daemon runs it once the file changed:
+        // read, hash, parse, index and diff against the previous table
+        auto previous = std::make_shared<MappingTable>();
+        parse_mappings(content, *previous, [](int, const char*, const char*) {});
+        build_indexes(*previous);
+        
+        std::string buffer;
+        run("reload_mappings", size, [&](uint64_t) {
+            if (!read_mapping_file(path, buffer)) {
+                return;
+            }
+            sink += content_hash(buffer);
+            MappingTable table;
+            table.mappings.reserve(previous->mappings.size());
+            parse_mappings(buffer, table, [](int, const char*, const char*) {});
+            build_indexes(table);
+            TableDiff diff;
+            diff_tables(*previous, table, diff);
+            sink += diff.added.size() + table.mappings.size();
+        });
+        run("parse_mappings", size, [&](uint64_t) {
+            MappingTable table;
+            table.mappings.reserve(size);
+            sink += parse_mappings(content, table, [](int, const char*, const char*) {}) + table.mappings.size();
+        });
+        run("build_indexes", size, [&](uint64_t) {
+            MappingTable table;
+            table.mappings = previous->mappings;
+            build_indexes(table);
+            sink += table.internal_index.node_count();
+        });
+        run("diff_tables", size, [&](uint64_t) {
+            TableDiff diff;
+            diff_tables(*previous, *previous, diff);
+            sink += diff.changed.size();
+        });
+        
+        const MappingTable& table = *previous;
+        std::vector<struct in6_addr> addresses = lookup_addresses(table, 4096);
+        std::vector<std::string> address_strings;
+        for (const auto& addr : addresses) {
+            address_strings.push_back(format_ipv6(addr));
+        }
+        
+        run("lookup_resolve", size, [&](uint64_t i) {
+            const NatMapping* mapping = nullptr;
+            struct in6_addr mapped;
+            bool is_internal = false;
+            sink += lookup_resolve(table, addresses[i & 4095], mapping, mapped, is_internal);
+        });
+        run("lookup_global", size, [&](uint64_t i) {
+            const NatMapping* mapping = nullptr;
+            struct in6_addr mapped;
+            sink += lookup_global(table, addresses[i & 4095], mapping, mapped);
+        });
+        run("resolve_ip", size, [&](uint64_t i) {
+            sink += resolve_ip(table, address_strings[i & 4095]).size();
+        });
+        run("get_global_ip", size, [&](uint64_t i) {
+            sink += get_global_ip(table, address_strings[i & 4095]).size();
+        });
+        
+        if (!keep_files) {
+            unlink(path.c_str());
+        }
+    }
+    
+    if (!keep_files) {
+        rmdir(dir.c_str());
+    }
+    return 0;
+}
@@ -1,94 +1,30 @@
 #include <iostream>
+#include <iomanip>
 #include <string>
 #include <vector>
+#include <functional>
+#include <chrono>
 #include <algorithm>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <nlohmann/json.hpp>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <memory>
+#include <thread>
+#include <random>
+#include <sstream>
+#include "../src-lib/slnat-client.h"
 
 using json = nlohmann::json;
 
-class SlickNatClient {
-private:
-    std::string server_address;
-    int server_port;
-    
-public:
-    SlickNatClient(const std::string& addr, int port = 7001)
-        : server_address(addr), server_port(port) {}
-    
-    json send_request(const json& request) {
-        int client_socket = socket(AF_INET6, SOCK_STREAM, 0);
-        if (client_socket == -1) {
-            return {{"error", "Failed to create socket"}};
-        }
-        
-        struct sockaddr_in6 server_addr;
-        memset(&server_addr, 0, sizeof(server_addr));
-        server_addr.sin6_family = AF_INET6;
-        server_addr.sin6_port = htons(server_port);
-        
-        if (inet_pton(AF_INET6, server_address.c_str(), &server_addr.sin6_addr) != 1) {
-            close(client_socket);
-            return {{"error", "Invalid server IPv6 address"}};
-        }
-        
-        if (connect(client_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
-            close(client_socket);
-            return {{"error", "Cannot connect to daemon at [" + server_address + "]:" + std::to_string(server_port)}};
-        }
-        
-        // Send request
-        std::string request_str = request.dump();
-        if (send(client_socket, request_str.c_str(), request_str.length(), 0) == -1) {
-            close(client_socket);
-            return {{"error", "Failed to send request"}};
-        }
-        
-        // Receive response
-        char buffer[2048];
-        ssize_t bytes_received = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
-        close(client_socket);
-        
-        if (bytes_received <= 0) {
-            return {{"error", "Failed to receive response"}};
-        }
-        
-        buffer[bytes_received] = '\0';
-        
-        try {
-            return json::parse(buffer);
-        } catch (const std::exception& e) {
-            return {{"error", std::string("Failed to parse response: ") + e.what()}};
-        }
-    }
-    
-    json resolve_ip(const std::string& ip) {
-        json request = {
-            {"command", "resolve_ip"},
-            {"ip", ip}
-        };
-        return send_request(request);
-    }
-    
-    json get_global_ip(const std::string& ip) {
-        json request = {
-            {"command", "get2kip"},
-            {"ip", ip}
-        };
-        return send_request(request);
-    }
-    
-    json ping() {
-        json request = {{"command", "ping"}};
-        return send_request(request);
-    }
-};
-
 // Helper function to expand IPv6 prefix
 std::string expand_ipv6_prefix(const std::string& prefix) {
     // Test if it's already a valid IPv6 address
@@ -138,123 +74,740 @@ std::string get_local_address_in_prefix(const std::string& prefix) {
     return "";
 }
 
+// Load generator behind "slnatc bench"
+struct BenchOptions {
+    int concurrency = 1;
+    double qps = 0;                 // Total target rate; 0 runs closed-loop
+    double duration_s = 10;
+    std::vector<std::pair<std::string, int>> mix = {{"get2kip", 1}};
+    std::string addresses_path;     // One address per line instead of random ones
+    std::string mappings_path = "/proc/net/slick_nat_mappings";
+};
+
+// get2kip only draws from internal prefixes so lookups can hit; resolve
+// draws from both sides
+struct BenchAddresses {
+    std::vector<std::string> internal;
+    std::vector<std::string> any;
+};
+
+struct BenchThreadResult {
+    std::vector<uint64_t> latencies_ns;
+    uint64_t errors = 0;
+    uint64_t not_found = 0;
+};
+
+// "get2kip", or weighted like "resolve=3,get2kip=1,ping=1"
+bool parse_bench_mix(const std::string& spec, std::vector<std::pair<std::string, int>>& mix) {
+    mix.clear();
+    std::istringstream iss(spec);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        std::string name = item;
+        int weight = 1;
+        size_t equals = item.find('=');
+        if (equals != std::string::npos) {
+            name = item.substr(0, equals);
+            try {
+                weight = std::stoi(item.substr(equals + 1));
+            } catch (const std::exception&) {
+                return false;
+            }
+        }
+        if ((name != "resolve" && name != "get2kip" && name != "ping") || weight < 0) {
+            return false;
+        }
+        if (weight > 0) {
+            mix.emplace_back(name, weight);
+        }
+    }
+    return !mix.empty();
+}
+
+// Reads addresses from a file, or makes random ones inside the prefixes of
+// a mapping file in the kernel's proc format
+bool load_bench_addresses(const BenchOptions& options, BenchAddresses& addresses, std::string& error) {
+    if (!options.addresses_path.empty()) {
+        std::ifstream file(options.addresses_path);
+        if (!file.is_open()) {
+            error = "Cannot open " + options.addresses_path;
+            return false;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            std::istringstream iss(line);
+            std::string ip;
+            struct in6_addr addr;
+            if (iss >> ip && ip[0] != '#' && inet_pton(AF_INET6, ip.c_str(), &addr) == 1) {
+                addresses.any.push_back(ip);
+            }
+        }
+        addresses.internal = addresses.any;
+        if (addresses.any.empty()) {
+            error = "No IPv6 addresses in " + options.addresses_path;
+            return false;
+        }
+        return true;
+    }
+    
+    std::ifstream file(options.mappings_path);
+    if (!file.is_open()) {
+        error = "Cannot open " + options.mappings_path;
+        return false;
+    }
+    
+    struct Prefix {
+        struct in6_addr addr;
+        int len;
+        bool internal;
+    };
+    std::vector<Prefix> prefixes;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream iss(line);
+        std::string interface, internal, arrow, external;
+        if (!(iss >> interface >> internal >> arrow >> external) || interface[0] == '#' || arrow != "->") {
+            continue;
+        }
+        for (const std::string* text : {&internal, &external}) {
+            size_t slash = text->find('/');
+            Prefix prefix;
+            prefix.internal = text == &internal;
+            try {
+                prefix.len = slash == std::string::npos ? -1 : std::stoi(text->substr(slash + 1));
+            } catch (const std::exception&) {
+                continue;
+            }
+            if (prefix.len >= 0 && prefix.len <= 128 &&
+                inet_pton(AF_INET6, text->substr(0, slash).c_str(), &prefix.addr) == 1) {
+                prefixes.push_back(prefix);
+            }
+        }
+    }
+    if (prefixes.empty()) {
+        error = "No mappings in " + options.mappings_path;
+        return false;
+    }
+    
+    std::mt19937_64 rng(std::random_device{}());
+    char text[INET6_ADDRSTRLEN];
+    for (size_t i = 0; i < 65536; i++) {
+        const Prefix& prefix = prefixes[rng() % prefixes.size()];
+        struct in6_addr addr;
+        uint64_t random_bits[2] = {rng(), rng()};
+        memcpy(addr.s6_addr, random_bits, sizeof(addr.s6_addr));
+        
+        int bytes = prefix.len / 8;
+        int bits = prefix.len % 8;
+        memcpy(addr.s6_addr, prefix.addr.s6_addr, bytes);
+        if (bits > 0) {
+            uint8_t mask = (0xFF << (8 - bits)) & 0xFF;
+            addr.s6_addr[bytes] = (prefix.addr.s6_addr[bytes] & mask) | (addr.s6_addr[bytes] & ~mask);
+        }
+        
+        inet_ntop(AF_INET6, &addr, text, sizeof(text));
+        addresses.any.push_back(text);
+        if (prefix.internal) {
+            addresses.internal.push_back(text);
+        }
+    }
+    if (addresses.internal.empty()) {
+        addresses.internal = addresses.any;
+    }
+    return true;
+}
+
+// Closed-loop threads send their next request as soon as the previous one
+// is answered. In open-loop mode requests fall due at fixed intervals and
+// latency counts from the due time, so a daemon that stalls cannot hide the
+// queueing it causes by slowing the sender down.
+int run_bench(const std::string& daemon_label, const std::function<std::unique_ptr<SlickNatClient>()>& make_client,
+              const BenchOptions& options, const BenchAddresses& addresses) {
+    int total_weight = 0;
+    std::string mix_text;
+    for (const auto& entry : options.mix) {
+        total_weight += entry.second;
+        mix_text += (mix_text.empty() ? "" : ",") + entry.first + "=" + std::to_string(entry.second);
+    }
+    
+    std::cout << "Benchmarking " << daemon_label << ": " << options.concurrency
+              << (options.concurrency == 1 ? " thread, " : " threads, ")
+              << (options.qps > 0 ? std::to_string(static_cast<long long>(options.qps)) + " req/s target"
+                                  : std::string("closed loop"))
+              << ", " << options.duration_s << " s, mix " << mix_text << std::endl;
+    
+    std::vector<BenchThreadResult> results(options.concurrency);
+    std::vector<std::thread> threads;
+    auto started = std::chrono::steady_clock::now();
+    auto deadline = started + std::chrono::nanoseconds(static_cast<int64_t>(options.duration_s * 1e9));
+    double interval_ns = options.qps > 0 ? 1e9 / options.qps : 0;
+    
+    for (int t = 0; t < options.concurrency; t++) {
+        threads.emplace_back([&, t]() {
+            std::unique_ptr<SlickNatClient> client = make_client();
+            std::mt19937_64 rng(std::random_device{}() + t);
+            BenchThreadResult& result = results[t];
+            
+            // Thread t owns every concurrency-th slot of the global schedule
+            for (uint64_t slot = t; ; slot += options.concurrency) {
+                auto sent = std::chrono::steady_clock::now();
+                if (interval_ns > 0) {
+                    auto due = started + std::chrono::nanoseconds(static_cast<int64_t>(slot * interval_ns));
+                    if (due >= deadline) {
+                        break;
+                    }
+                    if (due > sent) {
+                        std::this_thread::sleep_until(due);
+                    }
+                    sent = due;
+                } else if (sent >= deadline) {
+                    break;
+                }
+                
+                int pick = static_cast<int>(rng() % total_weight);
+                size_t command = 0;
+                while (pick >= options.mix[command].second) {
+                    pick -= options.mix[command].second;
+                    command++;
+                }
+                const std::string& name = options.mix[command].first;
+                
+                json response;
+                if (name == "ping") {
+                    response = client->ping();
+                } else if (name == "resolve") {
+                    response = client->query_resolve_ips({addresses.any[rng() % addresses.any.size()]}).front();
+                } else {
+                    response = client->query_global_ips({addresses.internal[rng() % addresses.internal.size()]})
+                                   .front();
+                }
+                
+                result.latencies_ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - sent).count());
+                if (response.value("status", "") == "not_found") {
+                    result.not_found++;
+                } else if (response.contains("error")) {
+                    result.errors++;
+                }
+            }
+        });
+    }
+    
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    
+    std::vector<uint64_t> latencies;
+    uint64_t errors = 0;
+    uint64_t not_found = 0;
+    for (const auto& result : results) {
+        latencies.insert(latencies.end(), result.latencies_ns.begin(), result.latencies_ns.end());
+        errors += result.errors;
+        not_found += result.not_found;
+    }
+    if (latencies.empty()) {
+        std::cerr << "Error: No requests completed" << std::endl;
+        return 1;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    
+    auto percentile_us = [&latencies](double quantile) {
+        size_t rank = static_cast<size_t>(quantile * latencies.size() + 0.5);
+        return latencies[std::min(latencies.size() - 1, rank > 0 ? rank - 1 : 0)] / 1000.0;
+    };
+    double rate = latencies.size() / elapsed_s;
+    
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Requests: " << latencies.size() << " in " << elapsed_s << " s (" << rate << " req/s), "
+              << errors << " errors, " << not_found << " not found" << std::endl;
+    std::cout << "Latency (us): p50 " << percentile_us(0.5) << ", p90 " << percentile_us(0.9) << ", p99 "
+              << percentile_us(0.99) << ", p99.9 " << percentile_us(0.999) << ", max "
+              << latencies.back() / 1000.0 << std::endl;
+    if (options.qps > 0 && rate < options.qps * 0.95) {
+        std::cout << "Warning: target rate not reached; latencies include time requests spent overdue" << std::endl;
+    }
+    
+    return errors == latencies.size() ? 1 : 0;
+}
+
+// Quotes a CSV field when it contains a separator, quote or line break
+std::string csv_field(const std::string& value) {
+    if (value.find_first_of(",\"\r\n") == std::string::npos) {
+        return value;
+    }
+    std::string quoted = "\"";
+    for (char c : value) {
+        quoted += c;
+        if (c == '"') {
+            quoted += '"';
+        }
+    }
+    return quoted + "\"";
+}
+
 void print_usage(const char* program_name) {
-    std::cout << "Usage: " << program_name << " <daemon_address> <command> [options]\n";
+    std::cout << "Usage: " << program_name << " [options] <daemon_address> <command> [args]\n";
+    std::cout << "  daemon_address is an IPv6 address or unix:/path for a unix socket listener\n";
     std::cout << "Commands:\n";
-    std::cout << "  get2kip [ip]                Get global unicast IP for local/specified IP\n";
-    std::cout << "  resolve <ip>                Resolve IP address mapping\n";
+    std::cout << "  get2kip [ip...]             Get global unicast IP for local/specified IPs\n";
+    std::cout << "  resolve <ip...>             Resolve IP address mappings\n";
+    std::cout << "  watch [prefix]              Print mapping changes as the daemon reports them\n";
+    std::cout << "  dump [prefix]               Print every mapping as NDJSON or CSV\n";
     std::cout << "  ping                        Ping the daemon\n";
+    std::cout << "  stats                       Show the daemon's request counters and latencies\n";
+    std::cout << "  bench                       Load-test the daemon and report latency percentiles\n";
+    std::cout << "\nOptions:\n";
+    std::cout << "  -p, --port PORT             Daemon port (default: 7001)\n";
+    std::cout << "  --ndjson                    Send all queries over one persistent connection\n";
+    std::cout << "                              (daemon listener must use 'ndjson')\n";
+    std::cout << "  --binary                    Use the compact binary protocol\n";
+    std::cout << "                              (daemon listener must use 'binary')\n";
+    std::cout << "  --udp                       Send each query as one datagram (listener must use 'udp')\n";
+    std::cout << "  --seqpacket                 One message per query on a unix listener using 'seqpacket'\n";
+    std::cout << "  --timeout MS                UDP reply timeout per attempt (default: 1000)\n";
+    std::cout << "  --retries N                 UDP resends after a timeout (default: 2)\n";
+    std::cout << "  --shm [PATH]                Look up get2kip/resolve in the daemon's shared-memory\n";
+    std::cout << "                              export (default: " << SLNAT_SHM_DEFAULT_PATH << ")\n";
+    std::cout << "  -i, --interface NAME        Only watch or dump mappings on this interface\n";
+    std::cout << "  --format ndjson|csv         Output format of dump (default: ndjson)\n";
+    std::cout << "  --page-size N               Mappings fetched per dump request (default: 10000)\n";
+    std::cout << "  --cache-ttl SECONDS         Reuse get2kip/resolve results across runs, checking\n";
+    std::cout << "                              the daemon's generation and instance once they\n";
+    std::cout << "                              are older\n";
+    std::cout << "\nBench options:\n";
+    std::cout << "  -c, --concurrency N         Threads, each with its own client (default: 1)\n";
+    std::cout << "  --qps N                     Total target rate; without it every thread sends\n";
+    std::cout << "                              its next request as soon as one is answered\n";
+    std::cout << "  --duration SECONDS          Run time (default: 10)\n";
+    std::cout << "  --mix SPEC                  Commands and weights, e.g. get2kip=3,resolve=1,ping=1\n";
+    std::cout << "                              (default: get2kip)\n";
+    std::cout << "  --addresses FILE            Query the addresses in FILE, one per line\n";
+    std::cout << "  --mappings FILE             Query random addresses inside the prefixes of a\n";
+    std::cout << "                              mapping file (default: /proc/net/slick_nat_mappings)\n";
     std::cout << "\nExamples:\n";
     std::cout << "  " << program_name << " ::1 get2kip 7607:af56:abb1:c7::100\n";
     std::cout << "  " << program_name << " 7000::1 get2kip\n";
     std::cout << "  " << program_name << " ::1 resolve 2a0a:8dc0:509b:21::1\n";
+    std::cout << "  " << program_name << " --ndjson -p 7002 ::1 resolve 7000::1 7000::2\n";
+    std::cout << "  " << program_name << " ::1 watch 7000::/16\n";
+    std::cout << "  " << program_name << " --format csv ::1 dump -i eth0 > mappings.csv\n";
+    std::cout << "  " << program_name << " --seqpacket unix:/run/slnatcd.sock get2kip 7000::100\n";
     std::cout << "  " << program_name << " ::1 ping\n";
+    std::cout << "  " << program_name << " ::1 stats\n";
+    std::cout << "  " << program_name << " --binary -p 7003 ::1 bench -c 8 --qps 50000 --mix get2kip=9,resolve=1\n";
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 3) {
+    int daemon_port = 7001;
+    bool use_ndjson = false;
+    bool use_binary = false;
+    bool use_udp = false;
+    bool use_seqpacket = false;
+    int udp_timeout_ms = 1000;
+    int udp_retries = 2;
+    std::string watch_interface;
+    std::string dump_format = "ndjson";
+    size_t dump_page_size = 10000;
+    int cache_ttl = 0;
+    std::string shm_path;
+    BenchOptions bench;
+    std::vector<std::string> args;
+    
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "-p" || arg == "--port") && i + 1 < argc) {
+            try {
+                daemon_port = std::stoi(argv[++i]);
+            } catch (const std::exception&) {
+                daemon_port = 0;
+            }
+            if (daemon_port < 1 || daemon_port > 65535) {
+                std::cerr << "Error: Invalid port: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--ndjson") {
+            use_ndjson = true;
+        } else if (arg == "--binary") {
+            use_binary = true;
+        } else if (arg == "--udp") {
+            use_udp = true;
+        } else if (arg == "--seqpacket") {
+            use_seqpacket = true;
+        } else if (arg == "--timeout" && i + 1 < argc) {
+            try {
+                udp_timeout_ms = std::stoi(argv[++i]);
+            } catch (const std::exception&) {
+                udp_timeout_ms = 0;
+            }
+            if (udp_timeout_ms < 1) {
+                std::cerr << "Error: Invalid timeout: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--retries" && i + 1 < argc) {
+            try {
+                udp_retries = std::stoi(argv[++i]);
+            } catch (const std::exception&) {
+                udp_retries = -1;
+            }
+            if (udp_retries < 0) {
+                std::cerr << "Error: Invalid retry count: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--cache-ttl" && i + 1 < argc) {
+            try {
+                cache_ttl = std::stoi(argv[++i]);
+            } catch (const std::exception&) {
+                cache_ttl = -1;
+            }
+            if (cache_ttl < 0) {
+                std::cerr << "Error: Invalid cache TTL: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--shm") {
+            // The path is optional; anything starting with '/' is taken as one
+            shm_path = SLNAT_SHM_DEFAULT_PATH;
+            if (i + 1 < argc && argv[i + 1][0] == '/') {
+                shm_path = argv[++i];
+            }
+        } else if ((arg == "-i" || arg == "--interface") && i + 1 < argc) {
+            watch_interface = argv[++i];
+        } else if (arg == "--format" && i + 1 < argc) {
+            dump_format = argv[++i];
+            if (dump_format != "ndjson" && dump_format != "csv") {
+                std::cerr << "Error: Invalid format: " << dump_format << std::endl;
+                return 1;
+            }
+        } else if (arg == "--page-size" && i + 1 < argc) {
+            long size = 0;
+            try {
+                size = std::stol(argv[++i]);
+            } catch (const std::exception&) {
+                size = 0;
+            }
+            if (size < 1) {
+                std::cerr << "Error: Invalid page size: " << argv[i] << std::endl;
+                return 1;
+            }
+            dump_page_size = size;
+        } else if ((arg == "-c" || arg == "--concurrency") && i + 1 < argc) {
+            try {
+                bench.concurrency = std::stoi(argv[++i]);
+            } catch (const std::exception&) {
+                bench.concurrency = 0;
+            }
+            if (bench.concurrency < 1) {
+                std::cerr << "Error: Invalid concurrency: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if ((arg == "--qps" || arg == "--duration") && i + 1 < argc) {
+            double value = 0;
+            try {
+                value = std::stod(argv[++i]);
+            } catch (const std::exception&) {
+                value = 0;
+            }
+            if (!(value > 0)) {
+                std::cerr << "Error: Invalid " << arg.substr(2) << ": " << argv[i] << std::endl;
+                return 1;
+            }
+            (arg == "--qps" ? bench.qps : bench.duration_s) = value;
+        } else if (arg == "--mix" && i + 1 < argc) {
+            if (!parse_bench_mix(argv[++i], bench.mix)) {
+                std::cerr << "Error: Invalid command mix: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--addresses" && i + 1 < argc) {
+            bench.addresses_path = argv[++i];
+        } else if (arg == "--mappings" && i + 1 < argc) {
+            bench.mappings_path = argv[++i];
+        } else if (arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        } else {
+            args.push_back(arg);
+        }
+    }
+    
+    if (args.size() < 2) {
         print_usage(argv[0]);
         return 1;
     }
     
-    std::string daemon_input = argv[1];
-    std::string command = argv[2];
+    std::string daemon_input = args[0];
+    std::string command = args[1];
+    std::vector<std::string> targets(args.begin() + 2, args.end());
     
     // Handle daemon address - expand if needed
-    std::string daemon_address = expand_ipv6_prefix(daemon_input);
+    bool is_unix = daemon_input.compare(0, 5, "unix:") == 0;
+    std::string daemon_address = is_unix ? daemon_input : expand_ipv6_prefix(daemon_input);
     
     // Validate the final address
     struct in6_addr test_addr;
-    if (inet_pton(AF_INET6, daemon_address.c_str(), &test_addr) != 1) {
+    if (!is_unix && inet_pton(AF_INET6, daemon_address.c_str(), &test_addr) != 1) {
         std::cerr << "Error: Invalid IPv6 address format: " << daemon_address << std::endl;
         std::cerr << "Original input: " << daemon_input << std::endl;
         return 1;
     }
+    if (use_seqpacket && (!is_unix || use_ndjson || use_udp)) {
+        std::cerr << "Error: --seqpacket needs a unix: daemon address and cannot be combined with --ndjson or --udp"
+                  << std::endl;
+        return 1;
+    }
     
-    int daemon_port = 7001;
+    auto configure_client = [&](SlickNatClient& target) {
+        target.set_seqpacket(use_seqpacket);
+        target.set_persistent(use_ndjson);
+        target.set_binary(use_binary);
+        if (use_udp) {
+            target.set_udp(true, udp_timeout_ms, udp_retries);
+        }
+        target.set_shm(shm_path);
+    };
     
     SlickNatClient client(daemon_address, daemon_port);
+    std::string daemon_label = client.daemon_name();
+    configure_client(client);
+    client.set_cache(cache_ttl * 1000);
     
     if (command == "get2kip") {
-        std::string target_ip;
-        
-        if (argc > 3) {
-            target_ip = argv[3];
-        } else {
+        if (targets.empty()) {
             // Try to get a local IP address
-            target_ip = get_local_address_in_prefix(daemon_input);
-            if (target_ip.empty()) {
+            std::string local_ip = get_local_address_in_prefix(daemon_input);
+            if (local_ip.empty()) {
                 std::cerr << "Error: Could not determine local IP address. Please specify an IP address." << std::endl;
                 std::cerr << "Usage: " << argv[0] << " " << daemon_input << " get2kip <ip_address>" << std::endl;
                 return 1;
             }
+            targets.push_back(local_ip);
         }
         
-        std::cout << "Connecting to daemon at [" << daemon_address << "]:" << daemon_port << std::endl;
-        std::cout << "Querying global IP for: " << target_ip << std::endl;
+        // With --shm the answers never come from a daemon connection
+        std::string source_label = shm_path.empty() ? "Daemon connection: " + daemon_label
+                                                    : "Shared-memory export: " + shm_path;
+        if (shm_path.empty()) {
+            std::cout << "Connecting to daemon at " << daemon_label << std::endl;
+        } else {
+            std::cout << "Reading mappings from " << shm_path << std::endl;
+        }
         
-        json response = client.get_global_ip(target_ip);
+        std::vector<json> responses = client.get_global_ips(targets);
         
-        if (response.contains("error")) {
-            std::cerr << "Error: " << response["error"] << std::endl;
-            std::cerr << "Daemon connection: [" << daemon_address << "]:" << daemon_port << std::endl;
-            return 1;
-        } else if (response.value("status", "") == "success") {
-            std::cout << "Internal IP: " << response["internal_ip"] << std::endl;
-            std::cout << "Global IP: " << response["global_ip"] << std::endl;
-            if (response.contains("interface")) {
-                std::cout << "Interface: " << response["interface"] << std::endl;
+        int result = 0;
+        for (size_t i = 0; i < targets.size(); i++) {
+            const std::string& target_ip = targets[i];
+            const json& response = responses[i];
+            
+            std::cout << "Querying global IP for: " << target_ip << std::endl;
+            
+            if (response.contains("error")) {
+                std::cerr << "Error: " << response["error"] << std::endl;
+                std::cerr << source_label << std::endl;
+                result = 1;
+            } else if (response.value("status", "") == "success") {
+                std::cout << "Internal IP: " << response["internal_ip"] << std::endl;
+                std::cout << "Global IP: " << response["global_ip"] << std::endl;
+                if (response.contains("interface")) {
+                    std::cout << "Interface: " << response["interface"] << std::endl;
+                }
+            } else {
+                std::cout << "IP " << target_ip << " not found in global mappings" << std::endl;
+                std::cout << source_label << std::endl;
+                result = 1;
             }
-        } else {
-            std::cout << "IP " << target_ip << " not found in global mappings" << std::endl;
-            std::cout << "Daemon connection: [" << daemon_address << "]:" << daemon_port << std::endl;
-            return 1;
         }
-        
+        return result;
+    
     } else if (command == "resolve") {
-        if (argc < 4) {
+        if (targets.empty()) {
             std::cerr << "Error: IP address required for resolve command" << std::endl;
             return 1;
         }
         
-        std::string target_ip = argv[3];
-        json response = client.resolve_ip(target_ip);
+        std::vector<json> responses = client.resolve_ips(targets);
         
-        if (response.contains("error")) {
-            std::cerr << "Error: " << response["error"] << std::endl;
-            return 1;
-        } else if (response.value("status", "") == "success") {
-            if (response.contains("internal_ip") && response.contains("public_ip")) {
-                std::cout << "Internal IP: " << response["internal_ip"] << std::endl;
-                std::cout << "Public IP: " << response["public_ip"] << std::endl;
-            } else if (response.contains("external_ip") && response.contains("internal_ip")) {
-                std::cout << "External IP: " << response["external_ip"] << std::endl;
-                std::cout << "Internal IP: " << response["internal_ip"] << std::endl;
-            }
-            if (response.contains("interface")) {
-                std::cout << "Interface: " << response["interface"] << std::endl;
+        int result = 0;
+        for (size_t i = 0; i < targets.size(); i++) {
+            const std::string& target_ip = targets[i];
+            const json& response = responses[i];
+            
+            if (response.contains("error")) {
+                std::cerr << "Error: " << response["error"] << std::endl;
+                result = 1;
+            } else if (response.value("status", "") == "success") {
+                if (response.contains("internal_ip") && response.contains("public_ip")) {
+                    std::cout << "Internal IP: " << response["internal_ip"] << std::endl;
+                    std::cout << "Public IP: " << response["public_ip"] << std::endl;
+                } else if (response.contains("external_ip") && response.contains("internal_ip")) {
+                    std::cout << "External IP: " << response["external_ip"] << std::endl;
+                    std::cout << "Internal IP: " << response["internal_ip"] << std::endl;
+                }
+                if (response.contains("interface")) {
+                    std::cout << "Interface: " << response["interface"] << std::endl;
+                }
+            } else {
+                std::cout << "IP " << target_ip << " not found in mappings" << std::endl;
+                result = 1;
             }
-        } else {
-            std::cout << "IP " << target_ip << " not found in mappings" << std::endl;
-            return 1;
         }
+        return result;
+    
+    } else if (command == "watch") {
+        std::string prefix = targets.empty() ? "" : targets.front();
+        
+        json error = client.watch(prefix, watch_interface, [&](const json& event) {
+            if (event.contains("status")) {
+                std::cout << "Watching mappings at " << daemon_label
+                          << " from generation " << event.value("generation", uint64_t(0)) << std::endl;
+                return true;
+            }
+            
+            std::string type = event.value("event", "");
+            if (type == "resync") {
+                std::cout << "Generation " << event.value("generation", uint64_t(0))
+                          << ": notifications were missed, re-query current mappings" << std::endl;
+                return true;
+            }
+            if (type != "update") {
+                return true;
+            }
+            
+            std::cout << "Generation " << event.value("generation", uint64_t(0)) << ":" << std::endl;
+            for (const auto& mapping : event.value("added", json::array())) {
+                std::cout << "  + " << mapping.value("interface", "") << " " << mapping.value("internal", "")
+                          << " -> " << mapping.value("external", "") << std::endl;
+            }
+            for (const auto& mapping : event.value("removed", json::array())) {
+                std::cout << "  - " << mapping.value("interface", "") << " " << mapping.value("internal", "")
+                          << " -> " << mapping.value("external", "") << std::endl;
+            }
+            for (const auto& mapping : event.value("changed", json::array())) {
+                std::cout << "  ~ " << mapping.value("interface", "") << " " << mapping.value("internal", "")
+                          << " -> " << mapping.value("external", "") << " (was "
+                          << mapping.value("previous_interface", "") << " -> "
+                          << mapping.value("previous_external", "") << ")" << std::endl;
+            }
+            return true;
+        });
+        
+        std::cerr << "Error: " << error["error"] << std::endl;
+        return 1;
+    
+    } else if (command == "dump") {
+        // Pages are fetched until the daemon stops returning a cursor. A
+        // reload between pages is reported, since the dump then mixes
+        // generations.
+        std::string prefix = targets.empty() ? "" : targets.front();
+        std::string cursor;
+        uint64_t generation = 0;
+        bool first_page = true;
         
+        if (dump_format == "csv") {
+            std::cout << "interface,internal,external,prefix_len\n";
+        }
+        do {
+            json page = client.list_mappings(prefix, watch_interface, cursor, dump_page_size);
+            if (page.contains("error")) {
+                std::cerr << "Error: " << page["error"] << std::endl;
+                std::cerr << "Tried to connect to: " << daemon_label << std::endl;
+                return 1;
+            }
+            
+            uint64_t page_generation = page.value("generation", uint64_t(0));
+            if (!first_page && page_generation != generation) {
+                std::cerr << "Warning: mappings changed during the dump (generation " << generation
+                          << " -> " << page_generation << ")" << std::endl;
+            }
+            generation = page_generation;
+            first_page = false;
+            
+            for (const auto& mapping : page.value("mappings", json::array())) {
+                if (dump_format == "csv") {
+                    std::cout << csv_field(mapping.value("interface", "")) << "," << mapping.value("internal", "")
+                              << "," << mapping.value("external", "") << "," << mapping.value("prefix_len", 0)
+                              << "\n";
+                } else {
+                    std::cout << mapping.dump() << "\n";
+                }
+            }
+            cursor = page.value("next_cursor", "");
+        } while (!cursor.empty());
+        std::cout.flush();
+    
     } else if (command == "ping") {
-        std::cout << "Pinging daemon at [" << daemon_address << "]:" << daemon_port << std::endl;
+        std::cout << "Pinging daemon at " << daemon_label << std::endl;
         
         json response = client.ping();
         
         if (response.contains("error")) {
             std::cerr << "Error: " << response["error"] << std::endl;
-            std::cerr << "Tried to connect to: [" << daemon_address << "]:" << daemon_port << std::endl;
+            std::cerr << "Tried to connect to: " << daemon_label << std::endl;
             return 1;
         } else {
-            std::cout << "Daemon at [" << daemon_address << "]:" << daemon_port << " is running" << std::endl;
+            std::cout << "Daemon at " << daemon_label << " is running" << std::endl;
             if (response.contains("status")) {
                 std::cout << "Response: " << response["status"] << std::endl;
             }
         }
+    
+    } else if (command == "bench") {
+        // Every thread gets its own connection; the result cache is left off
+        // so each request reaches the daemon
+        BenchAddresses addresses;
+        std::string error;
+        if (!load_bench_addresses(bench, addresses, error)) {
+            std::cerr << "Error: " << error << std::endl;
+            return 1;
+        }
+        return run_bench(daemon_label, [&]() {
+            std::unique_ptr<SlickNatClient> bench_client(new SlickNatClient(daemon_address, daemon_port));
+            configure_client(*bench_client);
+            return bench_client;
+        }, bench, addresses);
+    
+    } else if (command == "stats") {
+        json response = client.stats();
+        
+        if (response.contains("error")) {
+            std::cerr << "Error: " << response["error"] << std::endl;
+            std::cerr << "Tried to connect to: " << daemon_label << std::endl;
+            return 1;
+        }
         
+        const json& reloads = response["reloads"];
+        std::cout << "Daemon at " << daemon_label << ": generation " << response.value("generation", uint64_t(0))
+                  << ", " << response.value("mappings", 0) << " mappings, up "
+                  << response.value("uptime_seconds", 0) << "s" << std::endl;
+        std::cout << "Connections: " << response.value("connections", 0) << " ("
+                  << response.value("watchers", 0) << " watching), rejected: "
+                  << response.value("rejected_connections", 0) << ", timed out: "
+                  << response.value("timed_out_connections", 0) << ", parse errors: "
+                  << response.value("parse_errors", 0) << std::endl;
+        std::cout << "Reloads: " << reloads.value("count", 0) << " (" << reloads.value("failures", 0)
+                  << " failed), last took " << reloads.value("last_duration_ms", 0.0) << " ms" << std::endl;
+        if (response.contains("response_cache")) {
+            const json& cache = response["response_cache"];
+            std::cout << "Response cache: " << cache.value("hits", 0) << " hits, " << cache.value("misses", 0)
+                      << " misses (" << cache.value("entries_per_worker", 0) << " entries per worker)" << std::endl;
+        }
+        
+        std::cout << std::left << std::setw(14) << "command" << std::right << std::setw(11) << "requests"
+                  << std::setw(11) << "not_found" << std::setw(11) << "p50_us" << std::setw(11) << "p99_us"
+                  << std::setw(11) << "max_us" << std::endl;
+        std::cout << std::fixed << std::setprecision(1);
+        for (const auto& entry : response["commands"].items()) {
+            const json& counters = entry.value();
+            const json& latency = counters["latency_us"];
+            if (counters.value("requests", 0) == 0) {
+                continue;
+            }
+            std::cout << std::left << std::setw(14) << entry.key() << std::right
+                      << std::setw(11) << counters.value("requests", 0ULL)
+                      << std::setw(11) << counters.value("not_found", 0ULL)
+                      << std::setw(11) << latency.value("p50", 0.0) << std::setw(11) << latency.value("p99", 0.0)
+                      << std::setw(11) << latency.value("max", 0.0) << std::endl;
+        }
+    
     } else {
         std::cerr << "Unknown command: " << command << std::endl;
         print_usage(argv[0]);
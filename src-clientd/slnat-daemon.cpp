@@ -2,77 +2,500 @@
 #include <fstream>
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <thread>
 #include <mutex>
-#include <regex>
+#include <memory>
+#include <atomic>
 #include <chrono>
+#include <deque>
 #include <sstream>
 #include <algorithm>
+#include <random>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
+#include <cerrno>
 #include <signal.h>
 #include <nlohmann/json.hpp>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include "../src-common/slnat-binary.h"
+#include "../src-common/slnat-shm.h"
+#include "slnat-log.h"
+#include "slnat-table.h"
+#include "slnat-uring.h"
 
 using json = nlohmann::json;
 
-enum class LogLevel {
-    ERROR = 0,
-    WARNING = 1,
-    INFO = 2,
-    DEBUG = 3
+// Upper bound on a single buffered request before the connection is dropped
+static const size_t MAX_REQUEST_SIZE = 1024 * 1024;
+
+// Unsent notifications a watcher may accumulate before it is dropped
+static const size_t MAX_WATCH_BACKLOG = 4 * 1024 * 1024;
+
+// Recent change sets kept so watchers on a busy worker can catch up
+static const size_t WATCH_HISTORY_SIZE = 32;
+
+// Largest request accepted as a single SOCK_SEQPACKET message
+static const size_t MAX_MESSAGE_SIZE = 65536;
+
+// Listing output queued at a time; more follows as the socket drains
+static const size_t LIST_CHUNK_SIZE = 64 * 1024;
+
+// Most mappings per list_mappings page on seqpacket listeners, whose
+// whole reply must fit in one message
+static const size_t MESSAGE_LIST_LIMIT = 256;
+
+// io_uring backend: submission queue size and the recv buffers each worker
+// provides to the kernel
+static const unsigned URING_ENTRIES = 1024;
+static const unsigned URING_BUFFER_COUNT = 128;
+static const unsigned URING_BUFFER_SIZE = 16384;
+
+// Unprocessed input at which an io_uring connection stops receiving until
+// its responses have been sent, like the epoll backend's read-after-flush
+static const size_t URING_INPUT_LIMIT = 64 * 1024;
+
+// Where "snapshot" keeps the last loaded table across restarts; unlike the
+// shm export it must survive a reboot, so it does not live under /run
+static const char* const SNAPSHOT_DEFAULT_PATH = "/var/lib/slnatcd/mappings";
+
+enum class IoBackend {
+    EPOLL,      // Readiness via epoll, one system call per recv and send
+    IO_URING    // Multishot accept and recv with batched submission
+};
+
+enum class ListenMode {
+    JSON,       // One JSON request per connection, closed after the response
+    NDJSON,     // Persistent connection carrying newline-delimited JSON requests
+    BINARY,     // Persistent connection carrying fixed-size binary records
+    PROMETHEUS  // HTTP GET of the metrics in Prometheus text format
+};
+
+// Owns a listening socket. Listener sets share it, so a socket dropped by a
+// config reload stays open until every worker has moved off the old set.
+struct ListenSocket {
+    int fd;
+    std::string unix_path;  // Removed on close unless inherited or rebound since
+    ino_t inode = 0;
+    bool inherited;         // Passed in by systemd, which owns the path
+    
+    ListenSocket(int socket_fd, const std::string& path, bool from_systemd)
+        : fd(socket_fd), unix_path(path), inherited(from_systemd) {
+        struct stat st;
+        if (!unix_path.empty() && lstat(unix_path.c_str(), &st) == 0) {
+            inode = st.st_ino;
+        }
+    }
+    
+    ListenSocket(const ListenSocket&) = delete;
+    ListenSocket& operator=(const ListenSocket&) = delete;
+    
+    ~ListenSocket() {
+        struct stat st;
+        if (!unix_path.empty() && !inherited && lstat(unix_path.c_str(), &st) == 0 && st.st_ino == inode) {
+            unlink(unix_path.c_str());
+        }
+        close(fd);
+    }
 };
 
 struct ListenConfig {
     std::string address;
     int port;
+    std::string unix_path;  // Unix domain socket path instead of address/port
     int socket_fd;
+    ListenMode mode;
+    bool udp;               // One request (or batch) per datagram instead of TCP
+    bool seqpacket;         // Unix SOCK_SEQPACKET: one request per message
+    int shard = 0;          // This socket's index among the SO_REUSEPORT sockets
+    int shard_count = 1;    // sharing the address; 1 when not sharded
+    std::shared_ptr<ListenSocket> socket;   // Owner of socket_fd once it is open
+};
+
+using ListenerSet = std::vector<ListenConfig>;
+
+// Everything the config file sets. load_config parses it into a fresh
+// copy; a reload applies the listeners, log level and drain timeout of the
+// new copy in place, the rest only takes effect on the next start.
+struct DaemonSettings {
+    ListenerSet listeners;              // As configured, before sharding
+    LogLevel log_level = LogLevel::INFO;
+    int worker_count = 0;
+    int listen_shards = 1;              // SO_REUSEPORT sockets per TCP/UDP address; 0 for one per worker
+    std::vector<int> worker_cpus;       // Worker i is pinned to worker_cpus[i % size]; empty leaves them be
+    IoBackend io_backend = IoBackend::EPOLL;
+    std::string proc_mappings_path;
+    std::string shm_export_path;        // Empty unless shm_export is configured
+    std::string snapshot_path;          // Empty unless snapshot is configured
+    size_t response_cache_size = 4096;  // Entries per worker; 0 disables the cache
+    
+    // Admission control; a zero limit or timeout disables it
+    int listen_backlog = 128;
+    size_t max_connections = 4096;
+    int read_timeout_ms = 30000;        // For a complete request, or idle time between requests
+    int write_timeout_ms = 10000;       // Without progress while output is pending
+    
+    // Time SIGTERM leaves open connections to finish before workers stop
+    int drain_timeout_ms = 5000;
+    
+    // Proc polling backs off from min to max while the file is unchanged
+    int reload_interval_min_ms = 200;
+    int reload_interval_max_ms = 1000;
+};
+
+// Sockets passed in by systemd socket activation, numbered from 3. The
+// variables are cleared so that nothing started later takes them too.
+static std::vector<int> inherited_sockets() {
+    std::vector<int> fds;
+    const char* pid = getenv("LISTEN_PID");
+    const char* count = getenv("LISTEN_FDS");
+    if (pid && count && strtol(pid, nullptr, 10) == getpid()) {
+        long fd_count = strtol(count, nullptr, 10);
+        for (long i = 0; i < fd_count; i++) {
+            int fd = 3 + static_cast<int>(i);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fds.push_back(fd);
+        }
+    }
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    return fds;
+}
+
+// Whether an inherited socket is bound to what a listen directive asks for
+static bool socket_matches(int fd, const ListenConfig& config) {
+    int type = 0;
+    socklen_t type_len = sizeof(type);
+    struct sockaddr_storage storage;
+    socklen_t len = sizeof(storage);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_len) == -1 ||
+        getsockname(fd, reinterpret_cast<struct sockaddr*>(&storage), &len) == -1) {
+        return false;
+    }
+    
+    if (!config.unix_path.empty()) {
+        const struct sockaddr_un& addr = reinterpret_cast<const struct sockaddr_un&>(storage);
+        return storage.ss_family == AF_UNIX && type == (config.seqpacket ? SOCK_SEQPACKET : SOCK_STREAM) &&
+               strncmp(addr.sun_path, config.unix_path.c_str(), sizeof(addr.sun_path)) == 0;
+    }
+    
+    const struct sockaddr_in6& addr = reinterpret_cast<const struct sockaddr_in6&>(storage);
+    struct in6_addr wanted;
+    return storage.ss_family == AF_INET6 && type == (config.udp ? SOCK_DGRAM : SOCK_STREAM) &&
+           ntohs(addr.sin6_port) == config.port && inet_pton(AF_INET6, config.address.c_str(), &wanted) == 1 &&
+           memcmp(&addr.sin6_addr, &wanted, sizeof(wanted)) == 0;
+}
+
+// Listeners that can share a socket: the same address and socket type
+static bool same_socket(const ListenConfig& a, const ListenConfig& b) {
+    return a.unix_path == b.unix_path && a.address == b.address && a.port == b.port && a.udp == b.udp &&
+           a.seqpacket == b.seqpacket;
+}
+
+static std::string listen_name(const ListenConfig& config) {
+    if (!config.unix_path.empty()) {
+        return "unix:" + config.unix_path;
+    }
+    return "[" + config.address + "]:" + std::to_string(config.port);
+}
+
+// Requests are counted per command; binary records count under the
+// command they carry
+enum class StatCommand {
+    PING,
+    RESOLVE,
+    GET2KIP,
+    RESOLVE_BATCH,
+    GET2KIP_BATCH,
+    WATCH,
+    LIST_MAPPINGS,
+    STATS,
+    UNKNOWN,
+    COUNT
+};
+
+static const char* stat_command_name(StatCommand command) {
+    switch (command) {
+        case StatCommand::PING:          return "ping";
+        case StatCommand::RESOLVE:       return "resolve_ip";
+        case StatCommand::GET2KIP:       return "get2kip";
+        case StatCommand::RESOLVE_BATCH: return "resolve_batch";
+        case StatCommand::GET2KIP_BATCH: return "get2kip_batch";
+        case StatCommand::WATCH:         return "watch";
+        case StatCommand::LIST_MAPPINGS: return "list_mappings";
+        case StatCommand::STATS:         return "stats";
+        default:                         return "unknown";
+    }
+}
+
+// Counters are written only by the thread that owns them, so a relaxed
+// load and store is enough and avoids a locked read-modify-write
+static inline void bump(std::atomic<uint64_t>& counter, uint64_t amount = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+// Log-linear latency buckets in the spirit of HDR histograms: every power
+// of two from 128ns up is split into four linear sub-buckets, so reported
+// percentiles are within 25% of the true value.
+struct LatencyHistogram {
+    static const int MIN_SHIFT = 7;
+    static const int OCTAVES = 28;          // Up to 2^35 ns, about 34 s
+    static const int SUB_BUCKETS = 4;
+    static const int BUCKETS = 1 + OCTAVES * SUB_BUCKETS + 1;
+    
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> sum_ns;
+    std::atomic<uint64_t> max_ns;
+    
+    LatencyHistogram() : sum_ns(0), max_ns(0) {
+        for (auto& count : counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+    
+    void record(uint64_t ns, uint64_t times = 1) {
+        bump(counts[bucket_index(ns)], times);
+        bump(sum_ns, ns * times);
+        if (ns > max_ns.load(std::memory_order_relaxed)) {
+            max_ns.store(ns, std::memory_order_relaxed);
+        }
+    }
+    
+    static int bucket_index(uint64_t ns) {
+        if (ns < (1ULL << MIN_SHIFT)) {
+            return 0;
+        }
+        int log2 = 63 - __builtin_clzll(ns);
+        int octave = log2 - MIN_SHIFT;
+        if (octave >= OCTAVES) {
+            return BUCKETS - 1;
+        }
+        int sub = (ns >> (log2 - 2)) & (SUB_BUCKETS - 1);
+        return 1 + octave * SUB_BUCKETS + sub;
+    }
+    
+    // Exclusive upper bound of a bucket in nanoseconds
+    static uint64_t bucket_limit(int index) {
+        if (index == 0) {
+            return 1ULL << MIN_SHIFT;
+        }
+        if (index == BUCKETS - 1) {
+            return UINT64_MAX;
+        }
+        int octave = (index - 1) / SUB_BUCKETS;
+        int sub = (index - 1) % SUB_BUCKETS;
+        uint64_t base = 1ULL << (octave + MIN_SHIFT);
+        return base + (sub + 1) * (base / SUB_BUCKETS);
+    }
+};
+
+// One per worker thread, cache-line aligned so workers never share lines
+struct alignas(64) WorkerStats {
+    struct CommandStats {
+        std::atomic<uint64_t> requests{0};
+        std::atomic<uint64_t> not_found{0};
+        LatencyHistogram latency;
+    };
+    
+    CommandStats commands[static_cast<int>(StatCommand::COUNT)];
+    std::atomic<uint64_t> parse_errors{0};
+    std::atomic<uint64_t> connections{0};
+    std::atomic<uint64_t> rejected{0};         // Turned away at max_connections
+    std::atomic<uint64_t> timed_out{0};        // Closed by a read or write deadline
+    std::atomic<uint64_t> cache_hits{0};
+    std::atomic<uint64_t> cache_misses{0};
+    
+    CommandStats& command(StatCommand command) {
+        return commands[static_cast<int>(command)];
+    }
+};
+
+// Stats of the worker running on this thread; null on other threads
+static thread_local WorkerStats* thread_stats = nullptr;
+
+// Serialized resolve_ip/get2kip responses for recently queried addresses.
+// Each worker owns one, so lookups take no locks. Slots are direct-mapped by
+// address and command: a colliding query simply replaces the entry.
+class ResponseCache {
+public:
+    struct Entry {
+        StatCommand command = StatCommand::UNKNOWN;
+        struct in6_addr addr = {};
+        uint64_t generation = 0;
+        bool not_found = false;
+        std::string ip;
+        std::string response;       // Empty while the slot is unused
+    };
+    
+    explicit ResponseCache(size_t capacity) {
+        size_t slots = 1;
+        while (slots < capacity) {
+            slots <<= 1;
+        }
+        entries.resize(slots);
+        mask = slots - 1;
+    }
+    
+    // Responses echo the address as the client spelled it, so an entry only
+    // answers the same spelling; another one of the same address is a miss
+    const Entry* find(StatCommand command, const struct in6_addr& addr, const std::string& ip,
+                      uint64_t generation) const {
+        const Entry& entry = entries[slot(command, addr)];
+        if (entry.response.empty() || entry.generation != generation || entry.command != command ||
+            memcmp(&entry.addr, &addr, sizeof(addr)) != 0 || entry.ip != ip) {
+            return nullptr;
+        }
+        return &entry;
+    }
+    
+    void store(StatCommand command, const struct in6_addr& addr, const std::string& ip, uint64_t generation,
+               const std::string& response, bool not_found) {
+        Entry& entry = entries[slot(command, addr)];
+        entry.command = command;
+        entry.addr = addr;
+        entry.generation = generation;
+        entry.not_found = not_found;
+        entry.ip = ip;
+        entry.response = response;
+    }
+
+private:
+    std::vector<Entry> entries;
+    size_t mask;
+    
+    size_t slot(StatCommand command, const struct in6_addr& addr) const {
+        uint64_t high, low;
+        memcpy(&high, addr.s6_addr, sizeof(high));
+        memcpy(&low, addr.s6_addr + 8, sizeof(low));
+        uint64_t hash = (high * 0x9E3779B97F4A7C15ULL) ^ low ^ static_cast<uint64_t>(command);
+        hash *= 0xC2B2AE3D27D4EB4FULL;
+        return (hash >> 32) & mask;
+    }
 };
 
+// Response cache of the worker running on this thread; null when disabled
+static thread_local ResponseCache* thread_cache = nullptr;
+
 class SlickNatDaemon {
 private:
-    std::vector<ListenConfig> listen_configs;
-    bool running;
-    std::mutex mappings_mutex;
-    std::map<std::string, std::string> internal_to_external;
-    std::map<std::string, std::string> external_to_internal;
-    std::string proc_mappings_path;
+    // First so it outlives everything that logs
+    SlnatLogger logger;
+    DaemonSettings settings;            // As loaded at start, plus what reloads applied
+    std::string proc_path_option;       // --proc, unless proc_path overrides it
     std::string config_file_path;
+    std::atomic<bool> running;
+    
+    // Listeners being served. Replaced as a whole by a reload and read
+    // through std::atomic_load/std::atomic_store; workers keep the set they
+    // registered with until woken, so a dropped socket closes when the last
+    // worker has let go of it.
+    std::shared_ptr<const ListenerSet> listen_configs;
+    std::vector<int> inherited_fds;     // Sockets from systemd that no listener claimed yet
+    
+    // Set by the first SIGTERM or SIGINT: listeners are closed and workers
+    // exit once their connections are done
+    std::atomic<bool> draining;
+    std::atomic<int> active_workers;
+    
+    IoBackend io_backend;               // settings.io_backend unless io_uring is unavailable
+    std::atomic<int> uring_workers;     // Workers actually running on io_uring
+    std::atomic<size_t> open_connections;
     
     size_t last_mapping_count;
     bool proc_file_warning_shown;
-    LogLevel log_level;
+    std::atomic<LogLevel> log_level;
     
-    struct NatMapping {
-        std::string interface;
-        std::string internal_prefix;
-        std::string external_prefix;
-        int prefix_len;
+    // Reload state, touched only by the reloading thread
+    std::string proc_buffer;
+    uint64_t last_content_hash;
+    bool content_loaded;
+    
+    // Only touched through std::atomic_load/std::atomic_store
+    std::shared_ptr<const MappingTable> current_table;
+    
+    enum class ReloadResult {
+        FAILED,
+        UNCHANGED,
+        CHANGED
+    };
+    
+    // One reload's changes, copied out of the tables for watchers
+    struct ChangeSet {
+        uint64_t generation;
+        std::vector<NatMapping> added;
+        std::vector<NatMapping> removed;
+        std::vector<std::pair<NatMapping, NatMapping>> changed;
     };
     
-    std::vector<NatMapping> mappings;
+    // Change sets are only recorded while someone is watching. Workers are
+    // woken through their eventfd and push the changes to their watchers.
+    std::mutex watch_mutex;
+    std::deque<std::shared_ptr<const ChangeSet>> change_history;
+    std::atomic<int> watcher_count;
+    std::vector<int> wakeup_fds;
     
+    // Filled before the workers start and never resized afterwards; the
+    // stats command sums every worker's counters without locking
+    std::vector<std::unique_ptr<WorkerStats>> worker_stats;
+    std::chrono::steady_clock::time_point start_time;
+    
+    // Random per process, so clients caching answers notice a restart
+    uint64_t instance_id;
+    std::string instance_name;
+    
+    // Written only by the reloading thread
+    std::atomic<uint64_t> reload_count;
+    std::atomic<uint64_t> reload_failures;
+    std::atomic<uint64_t> last_reload_ns;
+    std::atomic<uint64_t> total_reload_ns;
+
 public:
     SlickNatDaemon(const std::string& config_path = "/etc/slnatcd/config",
                    const std::string& proc_path = "/proc/net/slick_nat_mappings")
-        : running(false), proc_mappings_path(proc_path), config_file_path(config_path),
-          last_mapping_count(0), proc_file_warning_shown(false), log_level(LogLevel::INFO) {}
+        : proc_path_option(proc_path), config_file_path(config_path), running(false),
+          listen_configs(std::make_shared<ListenerSet>()), draining(false), active_workers(0),
+          io_backend(IoBackend::EPOLL), uring_workers(0), open_connections(0),
+          last_mapping_count(0), proc_file_warning_shown(false), log_level(LogLevel::INFO),
+          last_content_hash(0), content_loaded(false),
+          current_table(initial_table()), watcher_count(0),
+          start_time(std::chrono::steady_clock::now()), instance_id(random_instance_id()),
+          instance_name(slnat_format_instance(instance_id)), reload_count(0), reload_failures(0),
+          last_reload_ns(0), total_reload_ns(0) {
+        settings.proc_mappings_path = proc_path;
+    }
     
     ~SlickNatDaemon() {
         stop();
     }
     
-    bool load_config() {
+    // Parses the config file into loaded, starting from the defaults. The
+    // log level applies as soon as it is read, so the rest of the parse
+    // logs at the configured level.
+    bool load_config(DaemonSettings& loaded) {
         std::ifstream config_file(config_file_path);
         if (!config_file.is_open()) {
             log_error("Cannot open config file " + config_file_path);
             return false;
         }
         
-        listen_configs.clear();
+        loaded = DaemonSettings();
+        loaded.proc_mappings_path = proc_path_option;
         std::string line;
         int line_number = 0;
         
@@ -91,7 +514,8 @@ public:
             if (directive == "log_level") {
                 std::string level_str;
                 if (iss >> level_str) {
-                    log_level = parse_log_level(level_str);
+                    loaded.log_level = parse_log_level(level_str);
+                    log_level = loaded.log_level;
                     log_info("Config: Log level set to " + level_str);
                     break;
                 }
@@ -115,32 +539,192 @@ public:
             iss >> directive;
             
             if (directive == "listen") {
-                std::string address_port_str;
-                std::getline(iss, address_port_str);
+                std::vector<std::string> tokens;
+                std::string token;
+                while (iss >> token) {
+                    tokens.push_back(token);
+                }
                 
-                // Trim leading whitespace
-                address_port_str.erase(0, address_port_str.find_first_not_of(" \t"));
+                // Address and port come first ("[addr]:port", "addr port" or
+                // "unix:/path"), followed by optional listener keywords
+                bool is_unix = !tokens.empty() && tokens[0].compare(0, 5, "unix:") == 0;
+                size_t option_start = (!tokens.empty() && (tokens[0][0] == '[' || is_unix)) ? 1 : 2;
+                std::string address_port_str;
+                for (size_t i = 0; i < option_start && i < tokens.size(); i++) {
+                    address_port_str += (i > 0 ? " " : "") + tokens[i];
+                }
                 
                 std::string address;
-                int port;
+                int port = 0;
+                ListenConfig config;
+                config.socket_fd = -1;
+                config.mode = ListenMode::JSON;
+                config.udp = false;
+                config.seqpacket = false;
+                
+                bool valid = tokens.size() >= option_start;
+                if (valid && is_unix) {
+                    config.unix_path = tokens[0].substr(5);
+                    valid = !config.unix_path.empty() && config.unix_path.size() < sizeof(sockaddr_un::sun_path);
+                } else if (valid) {
+                    valid = parse_address_port(address_port_str, address, port);
+                }
+                for (size_t i = option_start; valid && i < tokens.size(); i++) {
+                    valid = parse_listen_option(tokens[i], config);
+                }
+                if (valid && (config.udp || config.seqpacket) && config.mode == ListenMode::NDJSON) {
+                    log_error("ndjson framing is not available on udp or seqpacket listeners");
+                    valid = false;
+                }
+                if (valid && (config.udp || config.seqpacket) && config.mode == ListenMode::PROMETHEUS) {
+                    log_error("prometheus is only available on stream listeners");
+                    valid = false;
+                }
+                if (valid && config.udp && is_unix) {
+                    log_error("udp is not available on unix listeners");
+                    valid = false;
+                }
+                if (valid && config.seqpacket && !is_unix) {
+                    log_error("seqpacket is only available on unix listeners");
+                    valid = false;
+                }
                 
-                if (parse_address_port(address_port_str, address, port)) {
-                    ListenConfig config;
+                if (valid) {
                     config.address = address;
                     config.port = port;
-                    config.socket_fd = -1;
-                    listen_configs.push_back(config);
-                    log_info("Config: Will listen on [" + address + "]:" + std::to_string(port));
+                    loaded.listeners.push_back(config);
+                    log_info("Config: Will listen on " + listen_name(config) + " (" + listen_mode_name(config.mode) +
+                             (config.udp ? "/udp" : "") + (config.seqpacket ? "/seqpacket" : "") + ")");
                 } else {
                     log_error("Error parsing config line " + std::to_string(line_number) + ": " + line);
                     return false;
                 }
+            } else if (directive == "workers") {
+                int count;
+                if (iss >> count && count > 0) {
+                    loaded.worker_count = count;
+                    log_info("Config: Using " + std::to_string(count) + " worker threads");
+                } else {
+                    log_error("Invalid worker count on line " + std::to_string(line_number) + ": " + line);
+                    return false;
+                }
+            } else if (directive == "listen_shards") {
+                std::string value;
+                int shards = -1;
+                if (iss >> value) {
+                    try {
+                        shards = value == "auto" ? 0 : std::stoi(value);
+                    } catch (const std::exception&) {
+                        shards = -1;
+                    }
+                }
+                if (shards < 0) {
+                    log_error("Invalid listen shard count on line " + std::to_string(line_number) + ": " + line);
+                    return false;
+                }
+                loaded.listen_shards = shards;
+                log_info("Config: " + (shards ? std::to_string(shards) + " SO_REUSEPORT sockets per address"
+                                              : std::string("One SO_REUSEPORT socket per address and worker")));
+            } else if (directive == "cpu_affinity") {
+                std::string list;
+                if (!(iss >> list) || !parse_cpu_list(list, loaded.worker_cpus)) {
+                    log_error("Invalid CPU list on line " + std::to_string(line_number) + ": " + line);
+                    return false;
+                }
+                log_info("Config: Pinning workers to CPUs " + list);
+            } else if (directive == "io_backend") {
+                std::string backend;
+                iss >> backend;
+                if (backend == "epoll") {
+                    loaded.io_backend = IoBackend::EPOLL;
+                } else if (backend == "io_uring") {
+                    loaded.io_backend = IoBackend::IO_URING;
+                } else {
+                    log_error("Invalid I/O backend on line " + std::to_string(line_number) + ": " + line);
+                    return false;
+                }
+                log_info("Config: Using the " + backend + " backend");
+            } else if (directive == "reload_interval") {
+                int min_ms;
+                if (iss >> min_ms && min_ms > 0) {
+                    int max_ms = min_ms;
+                    if (!(iss >> max_ms)) {
+                        max_ms = std::max(min_ms, loaded.reload_interval_max_ms);
+                    }
+                    if (max_ms < min_ms) {
+                        log_error("Reload interval maximum below minimum on line " + std::to_string(line_number));
+                        return false;
+                    }
+                    loaded.reload_interval_min_ms = min_ms;
+                    loaded.reload_interval_max_ms = max_ms;
+                    log_info("Config: Polling mappings every " + std::to_string(min_ms) + "-" +
+                             std::to_string(max_ms) + " ms");
+                } else {
+                    log_error("Invalid reload interval on line " + std::to_string(line_number) + ": " + line);
+                    return false;
+                }
+            } else if (directive == "response_cache") {
+                long entries;
+                if (iss >> entries && entries >= 0 && entries <= (1L << 24)) {
+                    loaded.response_cache_size = entries;
+                    log_info("Config: " + (entries ? "Caching up to " + std::to_string(entries) +
+                             " responses per worker" : std::string("Response cache disabled")));
+                } else {
+                    log_error("Invalid response cache size on line " + std::to_string(line_number) + ": " + line);
+                    return false;
+                }
+            } else if (directive == "listen_backlog") {
+                int backlog;
+                if (iss >> backlog && backlog > 0) {
+                    loaded.listen_backlog = backlog;
+                    log_info("Config: Listen backlog " + std::to_string(backlog));
+                } else {
+                    log_error("Invalid listen backlog on line " + std::to_string(line_number) + ": " + line);
+                    return false;
+                }
+            } else if (directive == "max_connections") {
+                long limit;
+                if (iss >> limit && limit >= 0) {
+                    loaded.max_connections = limit;
+                    log_info("Config: " + (limit ? "Accepting at most " + std::to_string(limit) + " connections"
+                                                 : std::string("Connection limit disabled")));
+                } else {
+                    log_error("Invalid connection limit on line " + std::to_string(line_number) + ": " + line);
+                    return false;
+                }
+            } else if (directive == "read_timeout" || directive == "write_timeout") {
+                int timeout_ms;
+                if (iss >> timeout_ms && timeout_ms >= 0) {
+                    (directive == "read_timeout" ? loaded.read_timeout_ms : loaded.write_timeout_ms) = timeout_ms;
+                    log_info("Config: " + directive + " " + std::to_string(timeout_ms) + " ms");
+                } else {
+                    log_error("Invalid timeout on line " + std::to_string(line_number) + ": " + line);
+                    return false;
+                }
+            } else if (directive == "drain_timeout") {
+                int timeout_ms;
+                if (iss >> timeout_ms && timeout_ms >= 0) {
+                    loaded.drain_timeout_ms = timeout_ms;
+                    log_info("Config: Draining connections for up to " + std::to_string(timeout_ms) +
+                             " ms on shutdown");
+                } else {
+                    log_error("Invalid drain timeout on line " + std::to_string(line_number) + ": " + line);
+                    return false;
+                }
             } else if (directive == "proc_path") {
                 std::string path;
                 if (iss >> path) {
-                    proc_mappings_path = path;
+                    loaded.proc_mappings_path = path;
                     log_info("Config: Using proc path: " + path);
                 }
+            } else if (directive == "shm_export") {
+                std::string path;
+                loaded.shm_export_path = (iss >> path) ? path : SLNAT_SHM_DEFAULT_PATH;
+                log_info("Config: Exporting mappings to " + loaded.shm_export_path);
+            } else if (directive == "snapshot") {
+                std::string path;
+                loaded.snapshot_path = (iss >> path) ? path : SNAPSHOT_DEFAULT_PATH;
+                log_info("Config: Saving mapping snapshots to " + loaded.snapshot_path);
             } else if (directive == "log_level") {
                 // Already processed in first pass
                 continue;
@@ -149,7 +733,7 @@ public:
             }
         }
         
-        if (listen_configs.empty()) {
+        if (loaded.listeners.empty()) {
             log_error("No valid listen configurations found in config file");
             return false;
         }
@@ -157,73 +741,295 @@ public:
         return true;
     }
     
+    // Runs until SIGINT or SIGTERM, handling signals on the calling thread;
+    // main blocks them in every thread before the daemon is created
     bool start() {
-        if (!load_config()) {
+        if (!load_config(settings)) {
             return false;
         }
+        io_backend = settings.io_backend;
         
-        for (auto& config : listen_configs) {
-            if (!create_listen_socket(config)) {
-                log_error("Failed to create socket for [" + config.address + "]:" + std::to_string(config.port));
-                stop();
-                return false;
-            }
+        int count = settings.worker_count;
+        if (count <= 0) {
+            count = std::max(1u, std::thread::hardware_concurrency());
+        }
+        if (settings.listen_shards > count) {
+            log_warning("listen_shards capped at " + std::to_string(count) + ", the number of workers");
+        }
+        
+        inherited_fds = inherited_sockets();
+        if (!inherited_fds.empty()) {
+            log_info("Received " + std::to_string(inherited_fds.size()) + " sockets from systemd");
+        }
+        
+        auto opened = std::make_shared<ListenerSet>();
+        if (!open_listeners(settings.listeners, ListenerSet(), count, *opened)) {
+            stop();
+            return false;
+        }
+        std::atomic_store(&listen_configs, std::shared_ptr<const ListenerSet>(std::move(opened)));
+        for (int fd : inherited_fds) {
+            log_warning("Socket " + std::to_string(fd) + " from systemd matches no listen directive");
         }
         
         running = true;
-        log_info("SlickNat daemon started, listening on " + std::to_string(listen_configs.size()) + " addresses");
+        log_info("SlickNat daemon started, listening on " + std::to_string(settings.listeners.size()) +
+                 " addresses");
         
+        for (const std::string& path : {settings.shm_export_path, settings.snapshot_path}) {
+            size_t slash = path.rfind('/');
+            std::string dir = slash == std::string::npos ? "" : path.substr(0, slash);
+            if (!dir.empty() && mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST) {
+                log_error("Cannot create " + dir + ": " + std::string(strerror(errno)));
+            }
+        }
+        
+        if (!settings.snapshot_path.empty()) {
+            load_snapshot();
+        }
         reload_mappings();
         
+        if (io_backend == IoBackend::IO_URING && !uring_available()) {
+            io_backend = IoBackend::EPOLL;
+        }
+        
+        // Workers must exist before the reload thread can signal them
+        std::vector<int> epoll_fds;
+        for (int i = 0; i < count; i++) {
+            int wakeup_fd = -1;
+            int epoll_fd = create_worker_epoll(wakeup_fd);
+            if (epoll_fd == -1) {
+                for (size_t j = 0; j < epoll_fds.size(); j++) {
+                    close(epoll_fds[j]);
+                    close(wakeup_fds[j]);
+                }
+                wakeup_fds.clear();
+                stop();
+                return false;
+            }
+            epoll_fds.push_back(epoll_fd);
+            wakeup_fds.push_back(wakeup_fd);
+            worker_stats.emplace_back(new WorkerStats());
+        }
+        
         std::thread reload_thread(&SlickNatDaemon::mapping_reload_loop, this);
         reload_thread.detach();
         
-        std::vector<std::thread> accept_threads;
-        for (auto& config : listen_configs) {
-            accept_threads.emplace_back(&SlickNatDaemon::accept_loop, this, std::ref(config));
+        log_info("Serving requests with " + std::to_string(count) + " worker threads");
+        
+        std::vector<std::thread> worker_threads;
+        active_workers = count;
+        for (int i = 0; i < count; i++) {
+            worker_threads.emplace_back(&SlickNatDaemon::run_worker, this, i, epoll_fds[i], wakeup_fds[i],
+                                        worker_stats[i].get());
+            if (!settings.worker_cpus.empty()) {
+                pin_thread(worker_threads.back(), settings.worker_cpus[i % settings.worker_cpus.size()]);
+            }
         }
         
-        for (auto& thread : accept_threads) {
+        handle_signals();
+        
+        running = false;
+        wake_workers();
+        for (auto& thread : worker_threads) {
             thread.join();
         }
         
+        // The wakeup eventfds stay open: the detached reload thread may
+        // still signal them until the process exits
+        for (int fd : epoll_fds) {
+            close(fd);
+        }
         return true;
     }
     
     void stop() {
         running = false;
-        for (auto& config : listen_configs) {
-            if (config.socket_fd != -1) {
-                close(config.socket_fd);
-                config.socket_fd = -1;
-            }
+        // The last reference to each listening socket closes it, removing
+        // the path of a unix socket this process bound
+        std::atomic_store(&listen_configs, std::make_shared<const ListenerSet>());
+        if (!settings.shm_export_path.empty()) {
+            // Readers must not keep serving a table nobody updates
+            retire_export(settings.shm_export_path);
+            unlink(settings.shm_export_path.c_str());
         }
         log_info("SlickNat daemon stopped");
+        logger.stop();
     }
     
 private:
-    void log(LogLevel level, const std::string& message) {
-        if (level <= log_level) {
-            const char* level_str = "UNKNOWN";
-            switch (level) {
-                case LogLevel::ERROR:   level_str = "ERROR"; break;
-                case LogLevel::WARNING: level_str = "WARN"; break;
-                case LogLevel::INFO:    level_str = "INFO"; break;
-                case LogLevel::DEBUG:   level_str = "DEBUG"; break;
-            }
-            
-            if (level == LogLevel::ERROR || level == LogLevel::WARNING) {
-                std::cerr << "[" << level_str << "] " << message << std::endl;
-            } else {
-                std::cout << "[" << level_str << "] " << message << std::endl;
+    // SIGHUP reloads the config. The first SIGINT or SIGTERM starts a
+    // drain; the workers finishing, the drain timeout or a second signal
+    // ends it.
+    void handle_signals() {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGHUP);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        
+        std::chrono::steady_clock::time_point drain_deadline;
+        while (active_workers > 0) {
+            struct timespec timeout = {0, 100 * 1000 * 1000};
+            int signum = sigtimedwait(&signals, nullptr, &timeout);
+            if (signum == SIGHUP && !draining) {
+                log_info("Received SIGHUP, reloading " + config_file_path);
+                reload_config();
+            } else if (signum == SIGINT || signum == SIGTERM) {
+                if (draining) {
+                    log_warning("Received signal ", signum, " while draining, stopping now");
+                    break;
+                }
+                log_info("Received signal ", signum, ", draining connections");
+                drain_deadline = std::chrono::steady_clock::now() +
+                                 std::chrono::milliseconds(settings.drain_timeout_ms);
+                draining = true;
+                std::atomic_store(&listen_configs, std::make_shared<const ListenerSet>());
+                wake_workers();
+            }
+            
+            if (draining && std::chrono::steady_clock::now() >= drain_deadline) {
+                if (open_connections > 0) {
+                    log_warning("Drain timeout, closing " + std::to_string(open_connections.load()) +
+                                " open connections");
+                }
+                break;
+            }
+        }
+    }
+    
+    // Re-reads the config file and applies listener, log level and drain
+    // timeout changes in place. Sockets whose address stays are kept along
+    // with their queued and open connections, so only listeners that were
+    // added or removed notice. A config that fails to load changes nothing.
+    void reload_config() {
+        LogLevel previous_level = log_level;
+        DaemonSettings loaded;
+        if (!load_config(loaded)) {
+            log_level = previous_level;
+            log_error("Config reload failed, keeping the running configuration");
+            return;
+        }
+        
+        auto opened = std::make_shared<ListenerSet>();
+        int workers = static_cast<int>(wakeup_fds.size());
+        if (!open_listeners(loaded.listeners, *std::atomic_load(&listen_configs), workers, *opened)) {
+            log_level = previous_level;
+            log_error("Config reload failed, keeping the running configuration");
+            return;
+        }
+        std::atomic_store(&listen_configs, std::shared_ptr<const ListenerSet>(std::move(opened)));
+        wake_workers();
+        
+        for (const char* directive : restart_only_changes(loaded)) {
+            log_warning("Config: Changes to ", directive, " take effect after a restart");
+        }
+        settings.listeners = loaded.listeners;
+        settings.log_level = loaded.log_level;
+        settings.drain_timeout_ms = loaded.drain_timeout_ms;
+        log_level = loaded.log_level;
+        log_info("Config reloaded, listening on " + std::to_string(settings.listeners.size()) + " addresses");
+    }
+    
+    std::vector<const char*> restart_only_changes(const DaemonSettings& loaded) const {
+        std::vector<const char*> changed;
+        auto check = [&changed](bool differs, const char* directive) {
+            if (differs) {
+                changed.push_back(directive);
+            }
+        };
+        check(loaded.worker_count != settings.worker_count, "workers");
+        check(loaded.listen_shards != settings.listen_shards, "listen_shards");
+        check(loaded.worker_cpus != settings.worker_cpus, "cpu_affinity");
+        check(loaded.io_backend != settings.io_backend, "io_backend");
+        check(loaded.proc_mappings_path != settings.proc_mappings_path, "proc_path");
+        check(loaded.shm_export_path != settings.shm_export_path, "shm_export");
+        check(loaded.snapshot_path != settings.snapshot_path, "snapshot");
+        check(loaded.response_cache_size != settings.response_cache_size, "response_cache");
+        check(loaded.listen_backlog != settings.listen_backlog, "listen_backlog");
+        check(loaded.max_connections != settings.max_connections, "max_connections");
+        check(loaded.read_timeout_ms != settings.read_timeout_ms, "read_timeout");
+        check(loaded.write_timeout_ms != settings.write_timeout_ms, "write_timeout");
+        check(loaded.reload_interval_min_ms != settings.reload_interval_min_ms ||
+              loaded.reload_interval_max_ms != settings.reload_interval_max_ms, "reload_interval");
+        return changed;
+    }
+    
+    // Fills opened with a socket for every configured listener: the socket
+    // current already has for the address, one passed in by systemd, or a
+    // new one. New TCP and UDP listeners get listen_shards SO_REUSEPORT
+    // copies binding the same address, so the kernel spreads connections
+    // across them; worker i polls shard i % shards only, which with one
+    // shard per worker gives every worker its own accept queue. Sockets
+    // created here are closed again when this fails.
+    bool open_listeners(const ListenerSet& configured, const ListenerSet& current, int workers,
+                        ListenerSet& opened) {
+        int shards = settings.listen_shards == 0 ? workers : std::min(settings.listen_shards, workers);
+        
+        for (const auto& config : configured) {
+            bool kept = false;
+            for (const auto& open : current) {
+                if (same_socket(config, open)) {
+                    // The mode may have changed; the socket stays
+                    opened.push_back(open);
+                    opened.back().mode = config.mode;
+                    kept = true;
+                }
+            }
+            if (kept) {
+                continue;
+            }
+            
+            auto inherited = std::find_if(inherited_fds.begin(), inherited_fds.end(),
+                                          [&config](int fd) { return socket_matches(fd, config); });
+            if (inherited != inherited_fds.end()) {
+                opened.push_back(config);
+                opened.back().socket_fd = *inherited;
+                opened.back().socket = std::make_shared<ListenSocket>(*inherited, config.unix_path, true);
+                inherited_fds.erase(inherited);
+                log_info("Listening on " + listen_name(config) + " (socket from systemd)");
+                continue;
+            }
+            
+            // The kernel does not balance unix sockets across SO_REUSEPORT
+            int count = config.unix_path.empty() ? std::max(shards, 1) : 1;
+            for (int shard = 0; shard < count; shard++) {
+                opened.push_back(config);
+                opened.back().shard = shard;
+                opened.back().shard_count = count;
+                if (!create_listen_socket(opened.back())) {
+                    log_error("Failed to create socket for " + listen_name(config));
+                    return false;
+                }
             }
         }
+        return true;
+    }
+    
+    void pin_thread(std::thread& thread, int cpu) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        int error = pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+        if (error != 0) {
+            log_warning("Cannot pin worker to CPU " + std::to_string(cpu) + ": " + std::string(strerror(error)));
+        }
+    }
+    
+    // Messages are passed in pieces (strings, integers, LogAddress) that
+    // the logger's writer thread joins, so nothing is built for a level
+    // that is filtered out and a request path never formats or writes
+    template <typename... Parts>
+    void log(LogLevel level, const Parts&... parts) {
+        if (level <= log_level.load(std::memory_order_relaxed)) {
+            logger.log(level, parts...);
+        }
     }
     
-    void log_error(const std::string& message) { log(LogLevel::ERROR, message); }
-    void log_warning(const std::string& message) { log(LogLevel::WARNING, message); }
-    void log_info(const std::string& message) { log(LogLevel::INFO, message); }
-    void log_debug(const std::string& message) { log(LogLevel::DEBUG, message); }
+    template <typename... Parts> void log_error(const Parts&... parts) { log(LogLevel::ERROR, parts...); }
+    template <typename... Parts> void log_warning(const Parts&... parts) { log(LogLevel::WARNING, parts...); }
+    template <typename... Parts> void log_info(const Parts&... parts) { log(LogLevel::INFO, parts...); }
+    template <typename... Parts> void log_debug(const Parts&... parts) { log(LogLevel::DEBUG, parts...); }
     
     LogLevel parse_log_level(const std::string& level_str) {
         std::string lower_level = level_str;
@@ -237,6 +1043,78 @@ private:
         return LogLevel::INFO;
     }
     
+    // "auto" for every CPU this process may run on, otherwise comma-separated
+    // CPUs and ranges such as 0-7,16-23
+    static bool parse_cpu_list(const std::string& list, std::vector<int>& cpus) {
+        cpus.clear();
+        if (list == "auto") {
+            cpu_set_t allowed;
+            CPU_ZERO(&allowed);
+            if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+                return false;
+            }
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    cpus.push_back(cpu);
+                }
+            }
+            return !cpus.empty();
+        }
+        
+        std::istringstream iss(list);
+        std::string range;
+        while (std::getline(iss, range, ',')) {
+            size_t dash = range.find('-');
+            if (range.empty() || range.find_first_not_of("0123456789-") != std::string::npos ||
+                (dash != std::string::npos && range.find('-', dash + 1) != std::string::npos)) {
+                return false;
+            }
+            int first, last;
+            try {
+                first = std::stoi(range.substr(0, dash));
+                last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            } catch (const std::exception&) {
+                return false;
+            }
+            if (last < first || last >= CPU_SETSIZE) {
+                return false;
+            }
+            for (int cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        }
+        return !cpus.empty();
+    }
+    
+    bool parse_listen_option(const std::string& option, ListenConfig& config) {
+        if (option == "json") {
+            config.mode = ListenMode::JSON;
+        } else if (option == "ndjson") {
+            config.mode = ListenMode::NDJSON;
+        } else if (option == "binary") {
+            config.mode = ListenMode::BINARY;
+        } else if (option == "prometheus") {
+            config.mode = ListenMode::PROMETHEUS;
+        } else if (option == "udp") {
+            config.udp = true;
+        } else if (option == "seqpacket") {
+            config.seqpacket = true;
+        } else {
+            return false;
+        }
+        return true;
+    }
+    
+    static const char* listen_mode_name(ListenMode mode) {
+        switch (mode) {
+            case ListenMode::JSON:   return "json";
+            case ListenMode::NDJSON: return "ndjson";
+            case ListenMode::BINARY: return "binary";
+            case ListenMode::PROMETHEUS: return "prometheus";
+        }
+        return "unknown";
+    }
+    
     bool parse_address_port(const std::string& address_port_str, std::string& address, int& port) {
         // Handle bracketed IPv6 addresses: [::1]:7001
         if (!address_port_str.empty() && address_port_str[0] == '[') {
@@ -288,7 +1166,12 @@ private:
     }
     
     bool create_listen_socket(ListenConfig& config) {
-        config.socket_fd = socket(AF_INET6, SOCK_STREAM, 0);
+        if (!config.unix_path.empty()) {
+            return create_unix_socket(config);
+        }
+        
+        int type = config.udp ? SOCK_DGRAM : SOCK_STREAM;
+        config.socket_fd = socket(AF_INET6, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
         if (config.socket_fd == -1) {
             log_error("Failed to create IPv6 socket for " + config.address);
             return false;
@@ -298,6 +1181,7 @@ private:
         if (setsockopt(config.socket_fd, IPPROTO_IPV6, IPV6_V6ONLY, &ipv6only, sizeof(ipv6only)) == -1) {
             log_error("Failed to set IPv6 only for " + config.address);
             close(config.socket_fd);
+            config.socket_fd = -1;
             return false;
         }
         
@@ -305,6 +1189,14 @@ private:
         if (setsockopt(config.socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1) {
             log_error("Failed to set socket reuse for " + config.address);
             close(config.socket_fd);
+            config.socket_fd = -1;
+            return false;
+        }
+        if (config.shard_count > 1 &&
+            setsockopt(config.socket_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == -1) {
+            log_error("Failed to set SO_REUSEPORT for " + config.address);
+            close(config.socket_fd);
+            config.socket_fd = -1;
             return false;
         }
         
@@ -316,142 +1208,2125 @@ private:
         if (inet_pton(AF_INET6, config.address.c_str(), &addr.sin6_addr) != 1) {
             log_error("Invalid IPv6 address: " + config.address);
             close(config.socket_fd);
+            config.socket_fd = -1;
             return false;
         }
         
         if (bind(config.socket_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
             log_error("Failed to bind to [" + config.address + "]:" + std::to_string(config.port));
             close(config.socket_fd);
+            config.socket_fd = -1;
             return false;
         }
         
-        if (listen(config.socket_fd, 5) == -1) {
+        if (!config.udp && listen(config.socket_fd, settings.listen_backlog) == -1) {
             log_error("Failed to listen on [" + config.address + "]:" + std::to_string(config.port));
             close(config.socket_fd);
+            config.socket_fd = -1;
             return false;
         }
         
-        log_info("Listening on [" + config.address + "]:" + std::to_string(config.port));
+        config.socket = std::make_shared<ListenSocket>(config.socket_fd, config.unix_path, false);
+        log_info("Listening on [" + config.address + "]:" + std::to_string(config.port) +
+                 (config.udp ? " (udp)" : "") +
+                 (config.shard_count > 1 ? " shard " + std::to_string(config.shard + 1) + "/" +
+                                           std::to_string(config.shard_count) : ""));
         return true;
     }
     
-    void accept_loop(ListenConfig& config) {
-        while (running) {
-            struct sockaddr_in6 client_addr;
-            socklen_t client_len = sizeof(client_addr);
-            int client_socket = accept(config.socket_fd, (struct sockaddr*)&client_addr, &client_len);
-            
-            if (client_socket == -1) {
-                if (running) {
-                    log_error("Accept failed on " + config.address + ":" + std::to_string(config.port));
-                }
-                continue;
+    // Unix sockets are world-connectable, matching the TCP listeners
+    bool create_unix_socket(ListenConfig& config) {
+        int type = config.seqpacket ? SOCK_SEQPACKET : SOCK_STREAM;
+        config.socket_fd = socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (config.socket_fd == -1) {
+            log_error("Failed to create unix socket for " + config.unix_path);
+            return false;
+        }
+        
+        // A socket left behind by an earlier run would make bind fail
+        struct stat st;
+        if (lstat(config.unix_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(config.unix_path.c_str());
+        }
+        
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, config.unix_path.c_str(), config.unix_path.size());
+        
+        if (bind(config.socket_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            log_error("Failed to bind to " + listen_name(config) + ": " + std::string(strerror(errno)));
+            close(config.socket_fd);
+            config.socket_fd = -1;
+            return false;
+        }
+        chmod(config.unix_path.c_str(), 0666);
+        
+        if (listen(config.socket_fd, settings.listen_backlog) == -1) {
+            log_error("Failed to listen on " + listen_name(config));
+            close(config.socket_fd);
+            config.socket_fd = -1;
+            return false;
+        }
+        
+        config.socket = std::make_shared<ListenSocket>(config.socket_fd, config.unix_path, false);
+        log_info("Listening on " + listen_name(config) + (config.seqpacket ? " (seqpacket)" : ""));
+        return true;
+    }
+    
+    // Restricts which mappings a watcher is told about or a listing
+    // returns; empty means all
+    struct MappingFilter {
+        bool has_prefix = false;
+        struct in6_addr prefix;
+        int prefix_len = 0;
+        std::string interface;
+    };
+    
+    // A list_mappings response in progress. It holds on to the snapshot it
+    // started from, so the whole listing comes from one generation.
+    struct MappingListing {
+        std::shared_ptr<const MappingTable> table;
+        MappingFilter filter;
+        size_t position = 0;            // Next index into table->order
+        size_t remaining = 0;           // Mappings left before the page is full
+        size_t count = 0;
+        const NatMapping* last = nullptr;
+        std::string terminator;         // Newline on ndjson connections
+    };
+    
+    struct UringWorker;
+    
+    // Per-connection state, owned by the worker whose epoll instance accepted it
+    struct Connection {
+        int fd;
+        ListenMode mode;
+        std::string in_buf;
+        std::string out_buf;
+        size_t out_offset = 0;
+        bool readable = false;
+        bool close_after_write = false;
+        bool input_closed = false;  // The peer shut down its side
+        
+        // Deadlines: last_request restarts the read timeout whenever a
+        // response is queued; write_stalled_since is the last send that
+        // made progress before the socket filled up
+        std::chrono::steady_clock::time_point last_request;
+        bool write_blocked = false;
+        std::chrono::steady_clock::time_point write_stalled_since;
+        bool seqpacket = false;     // Each recv is one request, each reply one send
+        
+        // Set by the watch command; the connection then receives change notifications
+        bool watching = false;
+        uint64_t watch_generation = 0;
+        MappingFilter watch_filter;
+        
+        // Set by list_mappings until the last part has been queued; input
+        // is not read meanwhile so pipelined responses keep their order
+        std::unique_ptr<MappingListing> listing;
+        
+        // io_uring backend: completions carry the connection's serial so
+        // stale ones for a reused fd are ignored. send_buf holds the bytes
+        // of the send in flight, leaving out_buf free for new responses.
+        UringWorker* uring = nullptr;
+        uint32_t serial = 0;
+        bool recv_armed = false;
+        bool send_pending = false;
+        std::string send_buf;
+        size_t send_offset = 0;
+    };
+    
+    // Receive and reply buffers for one recvmmsg/sendmmsg round on a UDP listener
+    struct DatagramBatch {
+        static const int SIZE = 16;
+        static const size_t MAX_DATAGRAM = 65536;
+        
+        std::vector<char> storage;
+        struct mmsghdr in_msgs[SIZE];
+        struct mmsghdr out_msgs[SIZE];
+        struct iovec in_iov[SIZE];
+        struct iovec out_iov[SIZE];
+        struct sockaddr_in6 peers[SIZE];
+        std::string replies[SIZE];
+        
+        DatagramBatch() : storage(SIZE * MAX_DATAGRAM) {}
+    };
+    
+    // Each worker gets an epoll instance with an eventfd that the reload
+    // thread signals when watchers have news and the main thread when the
+    // listeners change. Listeners are registered by the worker itself.
+    int create_worker_epoll(int& wakeup_fd) {
+        int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd == -1) {
+            log_error("Failed to create epoll instance: " + std::string(strerror(errno)));
+            return -1;
+        }
+        
+        wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakeup_fd == -1) {
+            log_error("Failed to create worker eventfd: " + std::string(strerror(errno)));
+            close(epoll_fd);
+            return -1;
+        }
+        
+        struct epoll_event wakeup_event;
+        memset(&wakeup_event, 0, sizeof(wakeup_event));
+        wakeup_event.events = EPOLLIN;
+        wakeup_event.data.fd = wakeup_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &wakeup_event) == -1) {
+            log_error("Failed to register worker eventfd with epoll: " + std::string(strerror(errno)));
+            close(wakeup_fd);
+            close(epoll_fd);
+            return -1;
+        }
+        
+        return epoll_fd;
+    }
+    
+    void wake_workers() {
+        uint64_t signal = 1;
+        for (int fd : wakeup_fds) {
+            if (write(fd, &signal, sizeof(signal)) == -1 && errno != EAGAIN) {
+                log_debug("Failed to wake worker: ", strerror(errno));
+            }
+        }
+    }
+    
+    // Moves a worker from the listener set it serves to the published one,
+    // calling removed and added for its shards that differ. The old set is
+    // released last, so a dropped socket is still open while it is removed.
+    template <typename Removed, typename Added>
+    void refresh_listeners(int worker, std::shared_ptr<const ListenerSet>& serving, Removed removed, Added added) {
+        std::shared_ptr<const ListenerSet> latest = std::atomic_load(&listen_configs);
+        if (latest == serving) {
+            return;
+        }
+        auto mine = [worker](const ListenConfig& config) { return worker % config.shard_count == config.shard; };
+        auto contains = [](const ListenerSet& set, const ListenConfig& config) {
+            return std::any_of(set.begin(), set.end(), [&config](const ListenConfig& other) {
+                return other.socket == config.socket;
+            });
+        };
+        
+        for (const auto& config : *serving) {
+            if (mine(config) && !contains(*latest, config)) {
+                removed(config);
+            }
+        }
+        for (const auto& config : *latest) {
+            if (mine(config) && !contains(*serving, config)) {
+                added(config);
+            }
+        }
+        serving = latest;
+    }
+    
+    // Every worker registers its listening sockets with EPOLLEXCLUSIVE so the
+    // kernel wakes a single worker per incoming connection
+    void refresh_epoll_listeners(int worker, int epoll_fd, std::shared_ptr<const ListenerSet>& serving) {
+        refresh_listeners(worker, serving, [epoll_fd](const ListenConfig& config) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, config.socket_fd, nullptr);
+        }, [this, epoll_fd](const ListenConfig& config) {
+            struct epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN | EPOLLET | EPOLLEXCLUSIVE;
+            event.data.fd = config.socket_fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, config.socket_fd, &event) == -1) {
+                log_error("Failed to register " + listen_name(config) + " with epoll: " +
+                          std::string(strerror(errno)));
+            }
+        });
+    }
+    
+    // Only this worker's shards are registered with its epoll instance
+    static const ListenConfig* find_listener(const ListenerSet& listeners, int worker, int fd) {
+        for (const auto& config : listeners) {
+            if (worker % config.shard_count == config.shard && config.socket_fd == fd) {
+                return &config;
+            }
+        }
+        return nullptr;
+    }
+    
+    // Runs a worker on io_uring when configured and its ring can be set up,
+    // otherwise on the epoll instance prepared for it
+    void run_worker(int worker, int epoll_fd, int wakeup_fd, WorkerStats* stats) {
+        thread_stats = stats;
+        std::unique_ptr<ResponseCache> cache;
+        if (settings.response_cache_size > 0) {
+            cache.reset(new ResponseCache(settings.response_cache_size));
+            thread_cache = cache.get();
+        }
+
+#ifdef SLNAT_IO_URING
+        if (io_backend == IoBackend::IO_URING) {
+            UringWorker uring;
+            int error = init_uring_worker(uring);
+            if (error == 0) {
+                uring_workers++;
+                uring_worker_loop(worker, uring, wakeup_fd, stats);
+                thread_cache = nullptr;
+                active_workers--;
+                return;
+            }
+            log_warning("Worker " + std::to_string(worker) + " cannot use io_uring (" +
+                        std::string(strerror(-error)) + "), falling back to epoll");
+        }
+#endif
+        
+        worker_loop(worker, epoll_fd, wakeup_fd, stats);
+        thread_cache = nullptr;
+        active_workers--;
+    }
+    
+    // Deadlines are checked a few times per shortest timeout
+    int sweep_interval_ms() const {
+        int sweep_ms = 1000;
+        for (int timeout_ms : {settings.read_timeout_ms, settings.write_timeout_ms}) {
+            if (timeout_ms > 0) {
+                sweep_ms = std::min(sweep_ms, std::max(10, timeout_ms / 4));
+            }
+        }
+        return sweep_ms;
+    }
+    
+    void worker_loop(int worker, int epoll_fd, int wakeup_fd, WorkerStats* stats) {
+        std::unordered_map<int, Connection> connections;
+        std::unique_ptr<DatagramBatch> datagrams;
+        struct epoll_event events[64];
+        int sweep_ms = sweep_interval_ms();
+        auto next_sweep = std::chrono::steady_clock::now();
+        
+        auto serving = std::make_shared<const ListenerSet>();
+        refresh_epoll_listeners(worker, epoll_fd, serving);
+        
+        while (running) {
+            int count = epoll_wait(epoll_fd, events, 64, sweep_ms);
+            if (count == -1) {
+                if (errno != EINTR) {
+                    log_error("epoll_wait failed: " + std::string(strerror(errno)));
+                    break;
+                }
+                continue;
+            }
+            
+            for (int i = 0; i < count; i++) {
+                int fd = events[i].data.fd;
+                
+                if (fd == wakeup_fd) {
+                    // Clears the eventfd first, so a set published after
+                    // this wakeup brings another one
+                    notify_watchers(wakeup_fd, connections);
+                    refresh_epoll_listeners(worker, epoll_fd, serving);
+                    continue;
+                }
+                
+                const ListenConfig* listener = find_listener(*serving, worker, fd);
+                if (listener && listener->udp) {
+                    if (!datagrams) {
+                        datagrams.reset(new DatagramBatch());
+                    }
+                    serve_datagrams(*listener, *datagrams);
+                    continue;
+                }
+                if (listener) {
+                    accept_connections(epoll_fd, *listener, connections);
+                    continue;
+                }
+                
+                auto it = connections.find(fd);
+                if (it == connections.end()) {
+                    continue;
+                }
+                
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    it->second.readable = true;
+                }
+                
+                if (!service_connection(it->second)) {
+                    close_connection(connections, it);
+                }
+            }
+            
+            if (draining && drain_connections(connections)) {
+                break;
+            }
+            
+            auto now = std::chrono::steady_clock::now();
+            if (now >= next_sweep) {
+                expire_connections(connections, now);
+                next_sweep = now + std::chrono::milliseconds(sweep_ms);
+            }
+            
+            stats->connections.store(connections.size(), std::memory_order_relaxed);
+        }
+        
+        for (auto& entry : connections) {
+            close(entry.first);
+        }
+    }
+    
+    std::unordered_map<int, Connection>::iterator close_connection(
+            std::unordered_map<int, Connection>& connections, std::unordered_map<int, Connection>::iterator it) {
+        if (it->second.watching) {
+            watcher_count--;
+        }
+        open_connections--;
+#ifdef SLNAT_IO_URING
+        if (it->second.uring) {
+            uring_close(it->second);
+            return connections.erase(it);
+        }
+#endif
+        close(it->first);
+        return connections.erase(it);
+    }
+    
+    // Closes connections that missed a deadline: no complete request within
+    // read_timeout, or no write progress within write_timeout while output
+    // is pending. Watchers and listings only write, so only the latter
+    // applies to them.
+    void expire_connections(std::unordered_map<int, Connection>& connections,
+                            std::chrono::steady_clock::time_point now) {
+        auto read_timeout = std::chrono::milliseconds(settings.read_timeout_ms);
+        auto write_timeout = std::chrono::milliseconds(settings.write_timeout_ms);
+        
+        for (auto it = connections.begin(); it != connections.end();) {
+            const Connection& connection = it->second;
+            bool stalled = settings.write_timeout_ms > 0 && connection.write_blocked &&
+                           now - connection.write_stalled_since > write_timeout;
+            bool idle = settings.read_timeout_ms > 0 && !connection.write_blocked && !connection.watching &&
+                        !connection.listing && now - connection.last_request > read_timeout;
+            if (stalled || idle) {
+                log_debug("Closing connection that ", stalled ? "stopped reading" : "sent no request");
+                bump(thread_stats->timed_out);
+                it = close_connection(connections, it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    // While draining: closes watchers and persistent connections that have
+    // no request in progress. One-shot json and prometheus connections close
+    // themselves once answered. Returns true when nothing is left open.
+    bool drain_connections(std::unordered_map<int, Connection>& connections) {
+        for (auto it = connections.begin(); it != connections.end();) {
+            const Connection& connection = it->second;
+            bool persistent = connection.mode == ListenMode::NDJSON || connection.mode == ListenMode::BINARY ||
+                              connection.seqpacket;
+            bool busy = !connection.in_buf.empty() || connection.out_offset < connection.out_buf.size() ||
+                        connection.listing || connection.send_pending;
+            if (connection.watching || (persistent && !busy)) {
+                it = close_connection(connections, it);
+            } else {
+                ++it;
+            }
+        }
+        return connections.empty();
+    }
+    
+    // Answers a connection accepted beyond max_connections with a busy error
+    // in its listener's protocol and hangs up. The socket is new, so the
+    // short reply always fits its send buffer.
+    static void reject_connection(int fd, const ListenConfig& config) {
+        std::string reply;
+        if (config.mode == ListenMode::BINARY) {
+            // Unsolicited, with id 0, since no request has been read
+            SlnatBinaryResponse response;
+            memset(&response, 0, sizeof(response));
+            response.version = SLNAT_BINARY_VERSION;
+            response.status = SLNAT_STATUS_BUSY;
+            reply.assign(reinterpret_cast<const char*>(&response), sizeof(response));
+        } else if (config.mode == ListenMode::PROMETHEUS) {
+            reply = "HTTP/1.0 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        } else {
+            reply = "{\"error\":\"Daemon is busy\",\"status\":\"busy\"}";
+            if (config.mode == ListenMode::NDJSON) {
+                reply += '\n';
+            }
+        }
+        send(fd, reply.data(), reply.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(fd);
+    }
+    
+    // Queues every recorded change this worker's watchers have not seen yet
+    void notify_watchers(int wakeup_fd, std::unordered_map<int, Connection>& connections) {
+        uint64_t signals;
+        while (read(wakeup_fd, &signals, sizeof(signals)) == -1 && errno == EINTR) {
+        }
+        
+        std::vector<std::shared_ptr<const ChangeSet>> history;
+        {
+            std::lock_guard<std::mutex> lock(watch_mutex);
+            history.assign(change_history.begin(), change_history.end());
+        }
+        if (history.empty()) {
+            return;
+        }
+        
+        auto it = connections.begin();
+        while (it != connections.end()) {
+            Connection& connection = it->second;
+            if (!connection.watching || connection.watch_generation >= history.back()->generation) {
+                ++it;
+                continue;
+            }
+            
+            queue_watch_events(connection, history);
+            
+            if (connection.out_buf.size() - connection.out_offset > MAX_WATCH_BACKLOG) {
+                log_warning("Dropping watcher that is not reading its notifications");
+                it = close_connection(connections, it);
+            } else if (!service_connection(connection)) {
+                it = close_connection(connections, it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    void queue_watch_events(Connection& connection, const std::vector<std::shared_ptr<const ChangeSet>>& history) {
+        if (connection.out_offset == connection.out_buf.size()) {
+            connection.out_buf.clear();
+            connection.out_offset = 0;
+        }
+        
+        auto next = std::find_if(history.begin(), history.end(), [&connection](const std::shared_ptr<const ChangeSet>& changes) {
+            return changes->generation > connection.watch_generation;
+        });
+        
+        if ((*next)->generation != connection.watch_generation + 1) {
+            // The changes in between have left the history; the client has
+            // to query the current state again
+            connection.watch_generation = history.back()->generation;
+            connection.out_buf += "{\"event\":\"resync\",\"generation\":" +
+                                  std::to_string(connection.watch_generation) + "}\n";
+            return;
+        }
+        
+        for (; next != history.end(); ++next) {
+            append_change_event(connection.out_buf, **next, connection.watch_filter);
+            connection.watch_generation = (*next)->generation;
+        }
+    }
+    
+    // Appends one notification line, or nothing if the filter leaves it empty
+    static void append_change_event(std::string& out, const ChangeSet& changes, const MappingFilter& filter) {
+        size_t start = out.size();
+        bool matched = false;
+        
+        out += "{\"event\":\"update\",\"generation\":";
+        out += std::to_string(changes.generation);
+        
+        out += ",\"added\":[";
+        append_watched_mappings(out, changes.added, filter, matched);
+        out += "],\"removed\":[";
+        append_watched_mappings(out, changes.removed, filter, matched);
+        
+        out += "],\"changed\":[";
+        bool first = true;
+        for (const auto& change : changes.changed) {
+            if (!filter_matches(filter, change.first) && !filter_matches(filter, change.second)) {
+                continue;
+            }
+            out += first ? "{" : ",{";
+            first = false;
+            append_mapping_fields(out, change.second);
+            out += ",\"previous_interface\":";
+            append_json_string(out, change.first.interface);
+            out += ",\"previous_external\":\"";
+            append_prefix(out, change.first.external_addr, change.first.prefix_len);
+            out += "\"}";
+            matched = true;
+        }
+        out += "]}\n";
+        
+        if (!matched) {
+            out.resize(start);
+        }
+    }
+    
+    static void append_watched_mappings(std::string& out, const std::vector<NatMapping>& mappings,
+                                        const MappingFilter& filter, bool& matched) {
+        bool first = true;
+        for (const auto& mapping : mappings) {
+            if (!filter_matches(filter, mapping)) {
+                continue;
+            }
+            out += first ? "{" : ",{";
+            first = false;
+            append_mapping_fields(out, mapping);
+            out += '}';
+            matched = true;
+        }
+    }
+    
+    static void append_mapping_fields(std::string& out, const NatMapping& mapping) {
+        out += "\"interface\":";
+        append_json_string(out, mapping.interface);
+        out += ",\"internal\":\"";
+        append_prefix(out, mapping.internal_addr, mapping.prefix_len);
+        out += "\",\"external\":\"";
+        append_prefix(out, mapping.external_addr, mapping.prefix_len);
+        out += '"';
+    }
+    
+    static void append_prefix(std::string& out, const struct in6_addr& addr, int prefix_len) {
+        append_ipv6(out, addr);
+        out += '/';
+        out += std::to_string(prefix_len);
+    }
+    
+    // A prefix filter matches mappings whose internal or external prefix
+    // overlaps it, so a host can watch either side of its mapping
+    static bool filter_matches(const MappingFilter& filter, const NatMapping& mapping) {
+        if (!filter.interface.empty() && filter.interface != mapping.interface) {
+            return false;
+        }
+        if (!filter.has_prefix) {
+            return true;
+        }
+        int len = std::min(filter.prefix_len, mapping.prefix_len);
+        return prefix_equal(filter.prefix, mapping.internal_addr, len) ||
+               prefix_equal(filter.prefix, mapping.external_addr, len);
+    }
+    
+    // Drains a UDP listener in batches: one recvmmsg, answer each datagram,
+    // then one sendmmsg for all replies
+    void serve_datagrams(const ListenConfig& config, DatagramBatch& batch) {
+        while (running) {
+            for (int i = 0; i < DatagramBatch::SIZE; i++) {
+                batch.in_iov[i].iov_base = &batch.storage[i * DatagramBatch::MAX_DATAGRAM];
+                batch.in_iov[i].iov_len = DatagramBatch::MAX_DATAGRAM;
+                memset(&batch.in_msgs[i], 0, sizeof(batch.in_msgs[i]));
+                batch.in_msgs[i].msg_hdr.msg_iov = &batch.in_iov[i];
+                batch.in_msgs[i].msg_hdr.msg_iovlen = 1;
+                batch.in_msgs[i].msg_hdr.msg_name = &batch.peers[i];
+                batch.in_msgs[i].msg_hdr.msg_namelen = sizeof(batch.peers[i]);
+            }
+            
+            int received = recvmmsg(config.socket_fd, batch.in_msgs, DatagramBatch::SIZE, MSG_DONTWAIT, nullptr);
+            if (received == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK && running) {
+                    log_error("recvmmsg failed on ", listen_name(config), ": ", strerror(errno));
+                }
+                return;
+            }
+            
+            for (int i = 0; i < received; i++) {
+                const char* data = static_cast<const char*>(batch.in_iov[i].iov_base);
+                size_t length = batch.in_msgs[i].msg_len;
+                std::string& reply = batch.replies[i];
+                reply.clear();
+                
+                if (batch.in_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                    reply = json{{"error", "Datagram too large"}}.dump();
+                } else if (config.mode == ListenMode::BINARY) {
+                    bool bad_version = false;
+                    answer_binary_records(data, length / sizeof(SlnatBinaryRequest), reply, bad_version);
+                } else {
+                    bool incomplete = false;
+                    reply = handle_request(std::string(data, length), true, incomplete, nullptr, true);
+                }
+                
+                if (reply.size() > 65507) {
+                    reply = json{{"error", "Response too large for a datagram"}}.dump();
+                }
+                
+                batch.out_iov[i].iov_base = &reply[0];
+                batch.out_iov[i].iov_len = reply.size();
+                memset(&batch.out_msgs[i], 0, sizeof(batch.out_msgs[i]));
+                batch.out_msgs[i].msg_hdr.msg_iov = &batch.out_iov[i];
+                batch.out_msgs[i].msg_hdr.msg_iovlen = 1;
+                batch.out_msgs[i].msg_hdr.msg_name = &batch.peers[i];
+                batch.out_msgs[i].msg_hdr.msg_namelen = batch.in_msgs[i].msg_hdr.msg_namelen;
+            }
+            
+            // A reply that cannot be sent is dropped; UDP clients retry
+            int sent = 0;
+            while (sent < received) {
+                int result = sendmmsg(config.socket_fd, batch.out_msgs + sent, received - sent, MSG_DONTWAIT);
+                if (result == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    log_debug("Dropping UDP reply: ", strerror(errno));
+                    result = 1;
+                }
+                sent += result;
+            }
+        }
+    }
+    
+    void accept_connections(int epoll_fd, const ListenConfig& config,
+                            std::unordered_map<int, Connection>& connections) {
+        while (running) {
+            struct sockaddr_storage client_storage;
+            socklen_t client_len = sizeof(client_storage);
+            int client_socket = accept4(config.socket_fd, (struct sockaddr*)&client_storage, &client_len,
+                                        SOCK_NONBLOCK | SOCK_CLOEXEC);
+            
+            if (client_socket == -1) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK && running) {
+                    log_error("Accept failed on ", listen_name(config), ": ", strerror(errno));
+                }
+                return;
+            }
+            
+            if (settings.max_connections > 0 &&
+                open_connections.load(std::memory_order_relaxed) >= settings.max_connections) {
+                log_debug("Rejecting connection on ", listen_name(config), ": at max_connections");
+                bump(thread_stats->rejected);
+                reject_connection(client_socket, config);
+                continue;
+            }
+            
+            log_client(client_storage, config);
+            
+            struct epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.fd = client_socket;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &event) == -1) {
+                log_error("Failed to register client socket with epoll: ", strerror(errno));
+                close(client_socket);
+                continue;
+            }
+            
+            add_connection(connections, client_socket, config);
+        }
+    }
+    
+    // Per-connection lines are debug output: at info a busy daemon would
+    // spend its log ring on them
+    void log_client(const struct sockaddr_storage& client_storage, const ListenConfig& config) {
+        const struct sockaddr_in6& client_addr = reinterpret_cast<const struct sockaddr_in6&>(client_storage);
+        if (client_storage.ss_family != AF_INET6) {
+            log_debug("Client connected to ", listen_name(config));
+        } else {
+            log_debug("Client connected from [", LogAddress{client_addr.sin6_addr}, "]:",
+                      ntohs(client_addr.sin6_port), " to [", config.address, "]:", config.port);
+        }
+    }
+    
+    Connection& add_connection(std::unordered_map<int, Connection>& connections, int fd, const ListenConfig& config) {
+        Connection& connection = connections[fd];
+        connection.fd = fd;
+        connection.mode = config.mode;
+        connection.seqpacket = config.seqpacket;
+        connection.last_request = std::chrono::steady_clock::now();
+        open_connections++;
+        return connection;
+    }
+#ifdef SLNAT_IO_URING
+    
+    // What a completion belongs to, in the top byte of its user_data
+    enum class UringOp : uint8_t {
+        ACCEPT = 1,         // Multishot accept on a listener
+        RECV,               // Multishot recv into provided buffers
+        SEND,
+        POLL_CONNECTION,    // Readiness of a seqpacket connection
+        POLL_DATAGRAMS,     // Readiness of a UDP listener
+        POLL_WAKEUP,        // The worker's eventfd
+        CLOSE               // Cancellations and closes; nothing to do
+    };
+    
+    // One worker's ring. Completions are matched by user_data: the
+    // operation, a 24-bit connection serial and the fd.
+    struct UringWorker {
+        UringRing ring;
+        uint32_t next_serial = 0;
+        std::shared_ptr<const ListenerSet> listeners;   // The set this worker serves
+        
+        // Send buffers of connections closed with a send in flight, kept
+        // until the kernel is done with them
+        std::unordered_map<uint64_t, std::string> orphans;
+    };
+    
+    static uint64_t uring_data(UringOp op, uint32_t serial, int fd) {
+        return (static_cast<uint64_t>(op) << 56) | (static_cast<uint64_t>(serial & 0xFFFFFF) << 32) |
+               static_cast<uint32_t>(fd);
+    }
+    
+    static struct io_uring_sqe* uring_sqe(UringWorker& uring, uint8_t opcode, UringOp op, uint32_t serial, int fd) {
+        struct io_uring_sqe* sqe = uring.ring.get_sqe();
+        if (sqe) {
+            sqe->opcode = opcode;
+            sqe->fd = fd;
+            sqe->user_data = uring_data(op, serial, fd);
+        }
+        return sqe;
+    }
+    
+    // Checked once at startup, so a kernel without the features falls back
+    // as a whole rather than worker by worker
+    bool uring_available() {
+        if (!uring_kernel_supported()) {
+            log_warning("The io_uring backend needs Linux 6.0 or later, using epoll");
+            return false;
+        }
+        UringRing ring;
+        int error = ring.init(8);
+        if (error == 0) {
+            static const uint8_t ops[] = {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_CLOSE,
+                                          IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL};
+            error = ring.probe(ops, sizeof(ops));
+        }
+        if (error == 0) {
+            error = ring.setup_buffers(0, 1, 64);
+        }
+        if (error != 0) {
+            log_warning("io_uring is not available (" + std::string(strerror(-error)) + "), using epoll");
+            return false;
+        }
+        return true;
+    }
+    
+    int init_uring_worker(UringWorker& uring) {
+        int error = uring.ring.init(URING_ENTRIES);
+        if (error == 0) {
+            error = uring.ring.setup_buffers(0, URING_BUFFER_COUNT, URING_BUFFER_SIZE);
+        }
+        return error;
+    }
+    
+    // Multishot operations stay armed across completions; each is re-armed
+    // when a completion arrives without IORING_CQE_F_MORE
+    void uring_accept(UringWorker& uring, int listen_fd) {
+        struct io_uring_sqe* sqe = uring_sqe(uring, IORING_OP_ACCEPT, UringOp::ACCEPT, 0, listen_fd);
+        if (sqe) {
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            sqe->accept_flags = SOCK_CLOEXEC;
+        }
+    }
+    
+    void uring_poll(UringWorker& uring, UringOp op, uint32_t serial, int fd, uint32_t events) {
+        struct io_uring_sqe* sqe = uring_sqe(uring, IORING_OP_POLL_ADD, op, serial, fd);
+        if (sqe) {
+            // Edge-triggered, like the epoll registrations
+            sqe->len = IORING_POLL_ADD_MULTI;
+            sqe->poll32_events = events;
+        }
+    }
+    
+    // Arms accept or datagram polls on listeners new to this worker and
+    // cancels them on dropped ones, whose completions are ignored from then on
+    void refresh_uring_listeners(int worker, UringWorker& uring) {
+        refresh_listeners(worker, uring.listeners, [&uring](const ListenConfig& config) {
+            struct io_uring_sqe* cancel = uring_sqe(uring, IORING_OP_ASYNC_CANCEL, UringOp::CLOSE, 0,
+                                                    config.socket_fd);
+            if (cancel) {
+                cancel->addr = uring_data(config.udp ? UringOp::POLL_DATAGRAMS : UringOp::ACCEPT, 0,
+                                          config.socket_fd);
+            }
+        }, [this, &uring](const ListenConfig& config) {
+            if (config.udp) {
+                uring_poll(uring, UringOp::POLL_DATAGRAMS, 0, config.socket_fd, EPOLLIN);
+            } else {
+                uring_accept(uring, config.socket_fd);
+            }
+        });
+    }
+    
+    bool uring_recv(Connection& connection) {
+        UringWorker& uring = *connection.uring;
+        struct io_uring_sqe* sqe = uring_sqe(uring, IORING_OP_RECV, UringOp::RECV, connection.serial, connection.fd);
+        if (!sqe) {
+            return false;
+        }
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = uring.ring.group();
+        connection.recv_armed = true;
+        return true;
+    }
+    
+    // Hands all of out_buf to one send. MSG_WAITALL lets the kernel finish
+    // it across partial writes, so normally one completion covers it.
+    bool uring_send(Connection& connection) {
+        if (!connection.send_pending) {
+            connection.out_buf.erase(0, connection.out_offset);
+            connection.send_buf.swap(connection.out_buf);
+            connection.out_buf.clear();
+            connection.out_offset = 0;
+            connection.send_offset = 0;
+            connection.send_pending = true;
+            if (!connection.write_blocked) {
+                connection.write_blocked = true;
+                connection.write_stalled_since = std::chrono::steady_clock::now();
+            }
+        }
+        
+        struct io_uring_sqe* sqe = uring_sqe(*connection.uring, IORING_OP_SEND, UringOp::SEND, connection.serial,
+                                             connection.fd);
+        if (!sqe) {
+            return false;
+        }
+        sqe->addr = reinterpret_cast<uint64_t>(connection.send_buf.data() + connection.send_offset);
+        sqe->len = connection.send_buf.size() - connection.send_offset;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        return true;
+    }
+    
+    // Cancels whatever is in flight on the connection and closes its fd, in
+    // one hard-linked pair so the close only runs after the cancel
+    void uring_close(Connection& connection) {
+        UringWorker& uring = *connection.uring;
+        if (connection.send_pending) {
+            uring.orphans[uring_data(UringOp::SEND, connection.serial, connection.fd)] =
+                std::move(connection.send_buf);
+        }
+        
+        struct io_uring_sqe* cancel = uring_sqe(uring, IORING_OP_ASYNC_CANCEL, UringOp::CLOSE, 0, connection.fd);
+        if (!cancel) {
+            close(connection.fd);
+            return;
+        }
+        cancel->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        cancel->flags = IOSQE_IO_HARDLINK;
+        if (!uring_sqe(uring, IORING_OP_CLOSE, UringOp::CLOSE, 0, connection.fd)) {
+            // The cancel is queued, so the descriptor must stay open for
+            // it; the kernel releases the sockets with the ring
+            log_error("Cannot queue a close on the io_uring submission queue");
+        }
+    }
+    
+    // The io_uring counterpart of service_connection: received input sits in
+    // in_buf with readable set, and sends complete asynchronously. Input is
+    // only processed once earlier responses have been sent.
+    bool uring_service(Connection& connection) {
+        while (true) {
+            if (connection.send_pending) {
+                return true;
+            }
+            if (connection.out_offset < connection.out_buf.size()) {
+                return uring_send(connection);
+            }
+            if (connection.listing) {
+                if (!continue_listing(connection)) {
+                    return false;
+                }
+                continue;
+            }
+            if (connection.close_after_write) {
+                return false;
+            }
+            if (!connection.readable) {
+                break;
+            }
+            
+            connection.readable = false;
+            if (!process_input(connection, connection.input_closed)) {
+                return false;
+            }
+            note_response(connection);
+            if (connection.input_closed) {
+                // A watcher that half-closed still wants its notifications
+                connection.close_after_write = !connection.watching;
+            }
+        }
+        
+        if (!connection.recv_armed && !connection.input_closed) {
+            return uring_recv(connection);
+        }
+        return true;
+    }
+    
+    void uring_worker_loop(int worker, UringWorker& uring, int wakeup_fd, WorkerStats* stats) {
+        std::unordered_map<int, Connection> connections;
+        std::unique_ptr<DatagramBatch> datagrams;
+        int sweep_ms = sweep_interval_ms();
+        auto next_sweep = std::chrono::steady_clock::now();
+        
+        uring.listeners = std::make_shared<const ListenerSet>();
+        refresh_uring_listeners(worker, uring);
+        uring_poll(uring, UringOp::POLL_WAKEUP, 0, wakeup_fd, EPOLLIN);
+        
+        while (running) {
+            // Everything queued while handling the last batch of
+            // completions goes out with this one system call
+            int error = uring.ring.submit_and_wait(sweep_ms);
+            if (error != 0) {
+                log_error("io_uring_enter failed: ", strerror(-error));
+                break;
+            }
+            
+            uring.ring.for_each_completion([&](const struct io_uring_cqe& cqe) {
+                uring_complete(worker, uring, cqe, wakeup_fd, connections, datagrams);
+            });
+            
+            if (draining && drain_connections(connections)) {
+                break;
+            }
+            
+            auto now = std::chrono::steady_clock::now();
+            if (now >= next_sweep) {
+                expire_connections(connections, now);
+                next_sweep = now + std::chrono::milliseconds(sweep_ms);
+            }
+            
+            stats->connections.store(connections.size(), std::memory_order_relaxed);
+        }
+        
+        // Closing the ring cancels whatever is still in flight
+        for (auto& entry : connections) {
+            close(entry.first);
+        }
+    }
+    
+    void uring_complete(int worker, UringWorker& uring, const struct io_uring_cqe& cqe, int wakeup_fd,
+                        std::unordered_map<int, Connection>& connections, std::unique_ptr<DatagramBatch>& datagrams) {
+        UringOp op = static_cast<UringOp>(cqe.user_data >> 56);
+        uint32_t serial = (cqe.user_data >> 32) & 0xFFFFFF;
+        int fd = static_cast<int>(static_cast<uint32_t>(cqe.user_data));
+        bool more = cqe.flags & IORING_CQE_F_MORE;
+        
+        switch (op) {
+            case UringOp::ACCEPT: {
+                const ListenConfig* listener = find_listener(*uring.listeners, worker, fd);
+                if (!listener) {
+                    // Accepted just before the listener was cancelled
+                    if (cqe.res >= 0) {
+                        close(cqe.res);
+                    }
+                    return;
+                }
+                if (cqe.res >= 0) {
+                    uring_accepted(uring, *listener, cqe.res, connections);
+                } else if (cqe.res != -ECONNABORTED && cqe.res != -EINTR && cqe.res != -ECANCELED && running) {
+                    log_error("Accept failed on ", listen_name(*listener), ": ", strerror(-cqe.res));
+                }
+                if (!more && running) {
+                    uring_accept(uring, fd);
+                }
+                return;
+            }
+            case UringOp::POLL_DATAGRAMS: {
+                const ListenConfig* listener = find_listener(*uring.listeners, worker, fd);
+                if (!listener) {
+                    return;
+                }
+                if (!datagrams) {
+                    datagrams.reset(new DatagramBatch());
+                }
+                serve_datagrams(*listener, *datagrams);
+                if (!more && running) {
+                    uring_poll(uring, UringOp::POLL_DATAGRAMS, 0, fd, EPOLLIN);
+                }
+                return;
+            }
+            case UringOp::POLL_WAKEUP:
+                notify_watchers(wakeup_fd, connections);
+                refresh_uring_listeners(worker, uring);
+                if (!more && running) {
+                    uring_poll(uring, UringOp::POLL_WAKEUP, 0, wakeup_fd, EPOLLIN);
+                }
+                return;
+            case UringOp::CLOSE:
+                return;
+            default:
+                break;
+        }
+        
+        // Recv buffers always go back to the kernel, even for a connection
+        // that has been closed since
+        bool has_buffer = cqe.flags & IORING_CQE_F_BUFFER;
+        unsigned bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        auto it = connections.find(fd);
+        if (it == connections.end() || it->second.serial != serial) {
+            if (has_buffer) {
+                uring.ring.recycle_buffer(bid);
+            }
+            if (op == UringOp::SEND) {
+                uring.orphans.erase(cqe.user_data);
+            }
+            return;
+        }
+        
+        Connection& connection = it->second;
+        bool keep = true;
+        if (op == UringOp::RECV) {
+            if (has_buffer) {
+                if (cqe.res > 0) {
+                    connection.in_buf.append(uring.ring.buffer(bid), cqe.res);
+                }
+                uring.ring.recycle_buffer(bid);
+            }
+            if (!more) {
+                connection.recv_armed = false;
+            }
+            if (cqe.res == 0) {
+                connection.input_closed = true;
+                connection.readable = true;
+            } else if (cqe.res > 0) {
+                connection.readable = true;
+            } else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+                keep = false;
+            }
+            
+            if (keep) {
+                keep = uring_service(connection);
+            }
+            if (keep && connection.recv_armed && connection.send_pending &&
+                connection.in_buf.size() >= URING_INPUT_LIMIT) {
+                // The client keeps sending while not reading its answers;
+                // stop receiving until they have been sent
+                struct io_uring_sqe* cancel = uring_sqe(uring, IORING_OP_ASYNC_CANCEL, UringOp::CLOSE, 0, fd);
+                if (cancel) {
+                    cancel->addr = uring_data(UringOp::RECV, serial, fd);
+                }
+            }
+        } else if (op == UringOp::SEND) {
+            if (cqe.res < 0) {
+                keep = false;
+            } else {
+                connection.send_offset += cqe.res;
+                connection.write_stalled_since = std::chrono::steady_clock::now();
+                if (connection.send_offset < connection.send_buf.size()) {
+                    keep = uring_send(connection);
+                } else {
+                    connection.send_pending = false;
+                    connection.send_buf.clear();
+                    connection.write_blocked = false;
+                    keep = uring_service(connection);
+                }
+            }
+        } else if (op == UringOp::POLL_CONNECTION) {
+            if (cqe.res < 0) {
+                keep = false;
+            } else {
+                if (cqe.res & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    connection.readable = true;
+                }
+                keep = service_connection(connection);
+                if (keep && !more) {
+                    uring_poll(uring, UringOp::POLL_CONNECTION, serial, fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+                }
+            }
+        }
+        
+        if (!keep) {
+            close_connection(connections, it);
+        }
+    }
+    
+    // Connections arrive blocking: io_uring waits for the socket itself, and
+    // the kernel only retries sends with MSG_WAITALL on blocking sockets.
+    // Seqpacket connections keep the epoll backend's non-blocking reads and
+    // writes, driven by a multishot poll, since each recv must be a whole
+    // message.
+    void uring_accepted(UringWorker& uring, const ListenConfig& config, int fd,
+                        std::unordered_map<int, Connection>& connections) {
+        if (settings.max_connections > 0 &&
+            open_connections.load(std::memory_order_relaxed) >= settings.max_connections) {
+            log_debug("Rejecting connection on ", listen_name(config), ": at max_connections");
+            bump(thread_stats->rejected);
+            reject_connection(fd, config);
+            return;
+        }
+        
+        // Multishot accept cannot return the peer address, so it is only
+        // looked up when it is going to be logged
+        if (log_level >= LogLevel::DEBUG) {
+            struct sockaddr_storage client_storage;
+            socklen_t client_len = sizeof(client_storage);
+            if (getpeername(fd, reinterpret_cast<struct sockaddr*>(&client_storage), &client_len) == 0) {
+                log_client(client_storage, config);
+            }
+        }
+        
+        Connection& connection = add_connection(connections, fd, config);
+        connection.uring = &uring;
+        connection.serial = uring.next_serial++ & 0xFFFFFF;
+        
+        if (config.seqpacket) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            uring_poll(uring, UringOp::POLL_CONNECTION, connection.serial, fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+        } else if (!uring_recv(connection)) {
+            close_connection(connections, connections.find(fd));
+        }
+    }
+#else
+    
+    bool uring_available() {
+        log_warning("Built without io_uring support, using epoll");
+        return false;
+    }
+#endif
+    
+    // Alternates between flushing queued responses and reading more input.
+    // Input is only read once earlier responses have left, so a pipelining
+    // client that stops reading cannot grow out_buf without bound. Returns
+    // false when the connection should be closed.
+    bool service_connection(Connection& connection) {
+#ifdef SLNAT_IO_URING
+        if (connection.uring && !connection.seqpacket) {
+            return uring_service(connection);
+        }
+#endif
+        char buffer[16384];
+        
+        while (true) {
+            if (!flush_connection(connection)) {
+                return false;
+            }
+            if (connection.out_offset < connection.out_buf.size()) {
+                // Socket buffer full; resume on EPOLLOUT
+                return true;
+            }
+            if (connection.listing) {
+                if (!continue_listing(connection)) {
+                    return false;
+                }
+                continue;
+            }
+            if (connection.close_after_write) {
+                return false;
+            }
+            if (!connection.readable) {
+                return true;
+            }
+            if (connection.seqpacket) {
+                if (!read_message(connection)) {
+                    return false;
+                }
+                note_response(connection);
+                continue;
+            }
+            
+            ssize_t bytes_read = recv(connection.fd, buffer, sizeof(buffer), 0);
+            if (bytes_read > 0) {
+                connection.in_buf.append(buffer, bytes_read);
+                if (!process_input(connection, false)) {
+                    return false;
+                }
+                note_response(connection);
+            } else if (bytes_read == 0) {
+                connection.readable = false;
+                connection.input_closed = true;
+                if (!process_input(connection, true)) {
+                    return false;
+                }
+                // A watcher that half-closed still wants its notifications
+                connection.close_after_write = !connection.watching;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                connection.readable = false;
+            } else if (errno != EINTR) {
+                return false;
+            }
+        }
+    }
+    
+    // Input is only read once earlier output has left, so anything queued
+    // now answers a request that just completed
+    static void note_response(Connection& connection) {
+        if (connection.out_offset < connection.out_buf.size() || connection.listing) {
+            connection.last_request = std::chrono::steady_clock::now();
+        }
+    }
+    
+    // Reads and answers one SOCK_SEQPACKET message. The reply is queued as
+    // the whole of out_buf, which flush_connection sends as one message.
+    bool read_message(Connection& connection) {
+        char message[MAX_MESSAGE_SIZE];
+        ssize_t length = recv(connection.fd, message, sizeof(message), MSG_TRUNC);
+        if (length == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                connection.readable = false;
+                return true;
+            }
+            return errno == EINTR;
+        }
+        if (length == 0) {
+            connection.readable = false;
+            connection.close_after_write = true;
+            return true;
+        }
+        
+        connection.out_buf.clear();
+        connection.out_offset = 0;
+        
+        if (static_cast<size_t>(length) > sizeof(message)) {
+            if (connection.mode == ListenMode::BINARY) {
+                log_warning("Dropping connection with oversized binary message");
+                return false;
+            }
+            connection.out_buf = json{{"error", "Request too large"}}.dump();
+        } else if (connection.mode == ListenMode::BINARY) {
+            if (static_cast<size_t>(length) < sizeof(SlnatBinaryRequest)) {
+                return false;
+            }
+            bool bad_version = false;
+            answer_binary_records(message, length / sizeof(SlnatBinaryRequest), connection.out_buf, bad_version);
+            connection.close_after_write = bad_version;
+        } else {
+            bool incomplete = false;
+            connection.out_buf = handle_request(std::string(message, length), true, incomplete);
+        }
+        return true;
+    }
+    
+    // Turns buffered input into queued responses. final is set once the
+    // peer has shut down its side, so trailing data must be answered now.
+    bool process_input(Connection& connection, bool final) {
+        if (connection.mode == ListenMode::BINARY) {
+            // A trailing partial record at EOF can never be answered
+            process_binary_input(connection);
+        } else if (connection.mode == ListenMode::NDJSON) {
+            size_t start = 0;
+            size_t newline;
+            while (!connection.listing && (newline = connection.in_buf.find('\n', start)) != std::string::npos) {
+                queue_ndjson_response(connection, connection.in_buf.substr(start, newline - start));
+                start = newline + 1;
+            }
+            connection.in_buf.erase(0, start);
+            
+            if (final && !connection.listing && !connection.in_buf.empty()) {
+                queue_ndjson_response(connection, connection.in_buf);
+                connection.in_buf.clear();
+            }
+        } else if (connection.mode == ListenMode::PROMETHEUS) {
+            // Only the request line matters; wait for the end of the headers
+            // unless this cannot be HTTP at all (e.g. a JSON client)
+            bool not_http = !connection.in_buf.empty() && !isupper(static_cast<unsigned char>(connection.in_buf[0]));
+            if (not_http || connection.in_buf.find("\r\n\r\n") != std::string::npos ||
+                connection.in_buf.find("\n\n") != std::string::npos || (final && !connection.in_buf.empty())) {
+                connection.out_buf = http_metrics_response(connection.in_buf);
+                connection.out_offset = 0;
+                connection.close_after_write = true;
+                connection.in_buf.clear();
+            }
+        } else if (connection.watching) {
+            // A one-shot connection turned into a notification stream
+            connection.in_buf.clear();
+        } else if (!connection.in_buf.empty()) {
+            bool incomplete = false;
+            std::string response = handle_request(connection.in_buf, final, incomplete, &connection);
+            if (!incomplete) {
+                connection.in_buf.clear();
+                connection.out_buf = std::move(response);
+                connection.out_offset = 0;
+                if (connection.watching) {
+                    // Notifications follow as newline-delimited JSON
+                    connection.out_buf += '\n';
+                } else {
+                    connection.close_after_write = true;
+                }
+            }
+        }
+        
+        if (connection.in_buf.size() > MAX_REQUEST_SIZE) {
+            log_warning("Dropping connection with oversized request");
+            return false;
+        }
+        
+        return true;
+    }
+    
+    // Answers every complete request record in in_buf from one snapshot
+    void process_binary_input(Connection& connection) {
+        size_t count = connection.in_buf.size() / sizeof(SlnatBinaryRequest);
+        if (count == 0) {
+            return;
+        }
+        
+        if (connection.out_offset == connection.out_buf.size()) {
+            connection.out_buf.clear();
+            connection.out_offset = 0;
+        }
+        
+        bool bad_version = false;
+        size_t processed = answer_binary_records(connection.in_buf.data(), count, connection.out_buf, bad_version);
+        
+        connection.in_buf.erase(0, processed * sizeof(SlnatBinaryRequest));
+        if (bad_version) {
+            // Framing can no longer be trusted; answer once and hang up
+            connection.in_buf.clear();
+            connection.close_after_write = true;
+        }
+    }
+    
+    // Appends one response record per request record to out. Stops after
+    // answering a record with an unknown version. Returns records consumed.
+    size_t answer_binary_records(const char* data, size_t count, std::string& out, bool& bad_version) {
+        auto started = std::chrono::steady_clock::now();
+        uint64_t requests[static_cast<int>(StatCommand::COUNT)] = {};
+        uint64_t not_found[static_cast<int>(StatCommand::COUNT)] = {};
+        
+        auto table = snapshot();
+        uint64_t generation = htobe64(table->generation);
+        
+        size_t base = out.size();
+        out.resize(base + count * sizeof(SlnatBinaryResponse));
+        bad_version = false;
+        
+        size_t processed = 0;
+        while (processed < count && !bad_version) {
+            SlnatBinaryRequest request;
+            memcpy(&request, data + processed * sizeof(request), sizeof(request));
+            
+            SlnatBinaryResponse response;
+            memset(&response, 0, sizeof(response));
+            response.version = SLNAT_BINARY_VERSION;
+            response.id = request.id;
+            response.generation = generation;
+            if (table->stale) {
+                response.flags |= SLNAT_FLAG_STALE;
+            }
+            
+            struct in6_addr addr;
+            memcpy(addr.s6_addr, request.addr, sizeof(addr.s6_addr));
+            
+            const NatMapping* mapping = nullptr;
+            struct in6_addr mapped;
+            bool is_internal = false;
+            
+            StatCommand stat = StatCommand::UNKNOWN;
+            if (request.version != SLNAT_BINARY_VERSION) {
+                response.status = SLNAT_STATUS_BAD_REQUEST;
+                bad_version = true;
+            } else {
+                switch (request.command) {
+                    case SLNAT_CMD_PING:
+                        stat = StatCommand::PING;
+                        response.status = SLNAT_STATUS_SUCCESS;
+                        slnat_set_binary_instance(response, instance_id);
+                        break;
+                    case SLNAT_CMD_RESOLVE:
+                        stat = StatCommand::RESOLVE;
+                        lookup_resolve(*table, addr, mapping, mapped, is_internal);
+                        if (mapping && !is_internal) {
+                            response.flags |= SLNAT_FLAG_EXTERNAL_MATCH;
+                        }
+                        response.status = mapping ? SLNAT_STATUS_SUCCESS : SLNAT_STATUS_NOT_FOUND;
+                        break;
+                    case SLNAT_CMD_GET2KIP:
+                        stat = StatCommand::GET2KIP;
+                        lookup_global(*table, addr, mapping, mapped);
+                        response.status = mapping ? SLNAT_STATUS_SUCCESS : SLNAT_STATUS_NOT_FOUND;
+                        break;
+                    default:
+                        response.status = SLNAT_STATUS_BAD_REQUEST;
+                        break;
+                }
+            }
+            
+            if (mapping) {
+                memcpy(response.addr, mapped.s6_addr, sizeof(response.addr));
+                slnat_set_binary_interface(response, mapping->interface);
+            }
+            
+            if (!bad_version) {
+                requests[static_cast<int>(stat)]++;
+                if (response.status == SLNAT_STATUS_NOT_FOUND) {
+                    not_found[static_cast<int>(stat)]++;
+                }
+            } else if (thread_stats) {
+                bump(thread_stats->parse_errors);
+            }
+            
+            memcpy(&out[base + processed * sizeof(response)], &response, sizeof(response));
+            processed++;
+        }
+        
+        out.resize(base + processed * sizeof(SlnatBinaryResponse));
+        
+        uint64_t per_request_ns = elapsed_ns(started) / std::max<size_t>(processed, 1);
+        for (int i = 0; i < static_cast<int>(StatCommand::COUNT); i++) {
+            if (requests[i] > 0) {
+                record_requests(static_cast<StatCommand>(i), per_request_ns, requests[i], not_found[i]);
+            }
+        }
+        return processed;
+    }
+    
+    void queue_ndjson_response(Connection& connection, const std::string& line) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            return;
+        }
+        
+        if (connection.out_offset == connection.out_buf.size()) {
+            connection.out_buf.clear();
+            connection.out_offset = 0;
+        }
+        
+        bool incomplete = false;
+        connection.out_buf += handle_request(line, true, incomplete, &connection);
+        if (connection.listing) {
+            connection.listing->terminator = "\n";
+        } else {
+            connection.out_buf += '\n';
+        }
+    }
+    
+    // Queues the next part of a listing once everything before it has been
+    // sent. Pipelined requests waiting behind it are answered when it ends.
+    bool continue_listing(Connection& connection) {
+        connection.out_buf.clear();
+        connection.out_offset = 0;
+        if (!append_listing(connection.out_buf, *connection.listing, LIST_CHUNK_SIZE)) {
+            return true;
+        }
+        connection.listing.reset();
+        connection.last_request = std::chrono::steady_clock::now();
+        return connection.in_buf.empty() || process_input(connection, connection.input_closed);
+    }
+    
+    // Returns false only when the socket failed
+    bool flush_connection(Connection& connection) {
+        bool progress = false;
+        while (connection.out_offset < connection.out_buf.size()) {
+            ssize_t sent = send(connection.fd, connection.out_buf.data() + connection.out_offset,
+                                connection.out_buf.size() - connection.out_offset, MSG_NOSIGNAL);
+            if (sent > 0) {
+                connection.out_offset += sent;
+                progress = true;
+                continue;
             }
-            
-            char client_ip[INET6_ADDRSTRLEN];
-            if (inet_ntop(AF_INET6, &client_addr.sin6_addr, client_ip, sizeof(client_ip))) {
-                log_info("Client connected from [" + std::string(client_ip) + "]:" + 
-                         std::to_string(ntohs(client_addr.sin6_port)) + " to [" + config.address + "]:" + 
-                         std::to_string(config.port));
+            if (sent == -1 && errno == EINTR) {
+                continue;
             }
-            
-            std::thread client_thread(&SlickNatDaemon::handle_client, this, client_socket);
-            client_thread.detach();
+            if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                if (progress || !connection.write_blocked) {
+                    connection.write_blocked = true;
+                    connection.write_stalled_since = std::chrono::steady_clock::now();
+                }
+                return true;
+            }
+            return false;
         }
+        
+        connection.write_blocked = false;
+        return true;
     }
     
+    // Polls at the minimum interval right after a change and doubles the
+    // wait on every unchanged poll up to the maximum. The wait never drops
+    // below 20x the cost of the last poll, so huge tables cannot eat a core.
     void mapping_reload_loop() {
+        int interval_ms = settings.reload_interval_min_ms;
+        
         while (running) {
-            std::this_thread::sleep_for(std::chrono::seconds(5));
-            if (running) {
-                reload_mappings();
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+            if (!running) {
+                break;
+            }
+            
+            auto started = std::chrono::steady_clock::now();
+            ReloadResult result = reload_mappings();
+            auto cost_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - started).count();
+            
+            if (result == ReloadResult::CHANGED) {
+                interval_ms = settings.reload_interval_min_ms;
+            } else {
+                interval_ms = std::min(interval_ms * 2, settings.reload_interval_max_ms);
             }
+            interval_ms = std::max<int>(interval_ms, std::min<long long>(cost_ms * 20, 60000));
         }
     }
     
-    bool reload_mappings() {
-        std::ifstream proc_file(proc_mappings_path);
-        if (!proc_file.is_open()) {
+    ReloadResult reload_mappings() {
+        auto started = std::chrono::steady_clock::now();
+        if (!read_mapping_file(settings.proc_mappings_path, proc_buffer)) {
+            bump(reload_failures);
             if (!proc_file_warning_shown) {
-                log_warning("Cannot open " + proc_mappings_path);
+                log_warning("Cannot open " + settings.proc_mappings_path);
                 proc_file_warning_shown = true;
             }
-            return false;
+            return ReloadResult::FAILED;
         }
         
         if (proc_file_warning_shown) {
-            log_info("Successfully reopened " + proc_mappings_path);
+            log_info("Successfully reopened " + settings.proc_mappings_path);
             proc_file_warning_shown = false;
         }
         
-        std::lock_guard<std::mutex> lock(mappings_mutex);
-        mappings.clear();
-        internal_to_external.clear();
-        external_to_internal.clear();
+        uint64_t hash = content_hash(proc_buffer);
+        if (content_loaded && hash == last_content_hash) {
+            return ReloadResult::UNCHANGED;
+        }
         
-        std::string line;
-        std::regex mapping_regex(R"(^(\S+)\s+([a-fA-F0-9:]+)/(\d+)\s+->\s+([a-fA-F0-9:]+)/(\d+)$)");
+        auto previous = snapshot();
+        auto table = std::make_shared<MappingTable>();
+        table->mappings.reserve(previous->mappings.size());
         
-        while (std::getline(proc_file, line)) {
-            if (line.empty() || line[0] == '#') {
-                continue;
+        size_t logged = 0;
+        size_t malformed = parse_mappings(proc_buffer, *table,
+                                          [&](int line_number, const char* line, const char* line_end) {
+            if (++logged <= 5) {
+                log_warning("Malformed mapping on line ", line_number, " of ", settings.proc_mappings_path, ": ",
+                            std::string(line, line_end));
             }
-            
-            std::smatch match;
-            if (std::regex_match(line, match, mapping_regex)) {
-                NatMapping mapping;
-                mapping.interface = match[1];
-                mapping.internal_prefix = match[2];
-                mapping.external_prefix = match[4];
-                mapping.prefix_len = std::stoi(match[3]);
-                
-                mappings.push_back(mapping);
-                
-                build_lookup_maps(mapping);
+        });
+        
+        if (malformed > 5) {
+            log_warning("Skipped " + std::to_string(malformed) + " malformed lines in " +
+                        settings.proc_mappings_path);
+        }
+        
+        build_indexes(*table);
+        
+        TableDiff diff;
+        diff_tables(*previous, *table, diff);
+        
+        last_content_hash = hash;
+        content_loaded = true;
+        
+        size_t mapping_count = table->mappings.size();
+        uint64_t generation = publish_table(table);
+        
+        if (!settings.shm_export_path.empty()) {
+            export_table(*table);
+        }
+        if (!settings.snapshot_path.empty()) {
+            save_snapshot(*table);
+        }
+        
+        // Checked after publishing: a watcher registered too late to be
+        // counted here has already seen the new generation
+        if (watcher_count > 0) {
+            record_changes(generation, *previous, *table, diff);
+        }
+        
+        if (previous->stale) {
+            log_info("Replaced the startup snapshot with the mappings from " + settings.proc_mappings_path);
+        }
+        if (mapping_count != last_mapping_count || !diff.added.empty() || !diff.removed.empty() ||
+            !diff.changed.empty()) {
+            log_info("Loaded " + std::to_string(mapping_count) + " NAT mappings (" +
+                     std::to_string(diff.added.size()) + " added, " + std::to_string(diff.removed.size()) +
+                     " removed, " + std::to_string(diff.changed.size()) + " changed)");
+            last_mapping_count = mapping_count;
+        }
+        
+        uint64_t duration_ns = elapsed_ns(started);
+        bump(reload_count);
+        bump(total_reload_ns, duration_ns);
+        last_reload_ns.store(duration_ns, std::memory_order_relaxed);
+        
+        return ReloadResult::CHANGED;
+    }
+    
+    // Copies the changed mappings into the watch history and wakes every
+    // worker so it can notify its watchers
+    void record_changes(uint64_t generation, const MappingTable& before, const MappingTable& after,
+                        const TableDiff& diff) {
+        auto changes = std::make_shared<ChangeSet>();
+        changes->generation = generation;
+        for (uint32_t index : diff.added) {
+            changes->added.push_back(after.mappings[index]);
+        }
+        for (uint32_t index : diff.removed) {
+            changes->removed.push_back(before.mappings[index]);
+        }
+        for (const auto& change : diff.changed) {
+            changes->changed.emplace_back(before.mappings[change.first], after.mappings[change.second]);
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(watch_mutex);
+            change_history.push_back(std::move(changes));
+            while (change_history.size() > WATCH_HISTORY_SIZE) {
+                change_history.pop_front();
             }
         }
         
-        if (mappings.size() != last_mapping_count) {
-            log_info("Loaded " + std::to_string(mappings.size()) + " NAT mappings");
-            last_mapping_count = mappings.size();
+        wake_workers();
+    }
+    
+    // Serializes the table in the shm export layout, which the snapshot
+    // shares. Removes the file again if it cannot be written completely.
+    bool write_table_file(const MappingTable& table, const std::string& path, bool sync) {
+        size_t mapping_count = table.mappings.size();
+        size_t internal_nodes = table.internal_index.node_count();
+        size_t external_nodes = table.external_index.node_count();
+        
+        uint64_t size = sizeof(SlnatShmHeader);
+        auto section = [&size](size_t bytes) {
+            uint64_t start = size;
+            size += (bytes + 7) & ~static_cast<size_t>(7);
+            return start;
+        };
+        
+        SlnatShmHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SLNAT_SHM_MAGIC, sizeof(header.magic));
+        header.version = SLNAT_SHM_VERSION;
+        header.header_size = sizeof(header);
+        header.generation = table.generation;
+        header.mapping_count = static_cast<uint32_t>(mapping_count);
+        header.internal_node_count = static_cast<uint32_t>(internal_nodes);
+        header.external_node_count = static_cast<uint32_t>(external_nodes);
+        header.mappings_offset = section(mapping_count * sizeof(SlnatShmMapping));
+        header.internal_nodes_offset = section(internal_nodes * sizeof(SlnatShmNode));
+        header.external_nodes_offset = section(external_nodes * sizeof(SlnatShmNode));
+        header.internal_values_offset = section(mapping_count * sizeof(int32_t));
+        header.external_values_offset = section(mapping_count * sizeof(int32_t));
+        header.file_size = size;
+        
+        std::string data(size, '\0');
+        memcpy(&data[0], &header, sizeof(header));
+        
+        SlnatShmMapping* mappings = reinterpret_cast<SlnatShmMapping*>(&data[header.mappings_offset]);
+        for (size_t i = 0; i < mapping_count; i++) {
+            const NatMapping& mapping = table.mappings[i];
+            memcpy(mappings[i].internal_addr, mapping.internal_addr.s6_addr, sizeof(mappings[i].internal_addr));
+            memcpy(mappings[i].external_addr, mapping.external_addr.s6_addr, sizeof(mappings[i].external_addr));
+            mappings[i].prefix_len = mapping.prefix_len;
+            memcpy(mappings[i].interface, mapping.interface.data(),
+                   std::min(mapping.interface.size(), sizeof(mappings[i].interface)));
+        }
+        table.internal_index.export_nodes(reinterpret_cast<SlnatShmNode*>(&data[header.internal_nodes_offset]));
+        table.external_index.export_nodes(reinterpret_cast<SlnatShmNode*>(&data[header.external_nodes_offset]));
+        table.internal_index.export_values(reinterpret_cast<int32_t*>(&data[header.internal_values_offset]), mapping_count);
+        table.external_index.export_values(reinterpret_cast<int32_t*>(&data[header.external_values_offset]), mapping_count);
+        
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            log_error("Cannot write " + path + ": " + std::string(strerror(errno)));
+            return false;
         }
         
+        size_t written = 0;
+        while (written < data.size()) {
+            ssize_t result = write(fd, data.data() + written, data.size() - written);
+            if (result == -1 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                log_error("Failed to write " + path + ": " + std::string(strerror(errno)));
+                close(fd);
+                unlink(path.c_str());
+                return false;
+            }
+            written += result;
+        }
+        if (sync && fsync(fd) == -1) {
+            log_error("Failed to sync " + path + ": " + std::string(strerror(errno)));
+            close(fd);
+            unlink(path.c_str());
+            return false;
+        }
+        close(fd);
         return true;
     }
     
-    void build_lookup_maps(const NatMapping& mapping) {
-        std::string internal_key = mapping.internal_prefix + "/" + std::to_string(mapping.prefix_len);
-        std::string external_key = mapping.external_prefix + "/" + std::to_string(mapping.prefix_len);
+    // Writes the table to a temporary file and renames it over the export
+    // path, so readers only ever map complete tables, then flags the file it
+    // replaced so they remap
+    void export_table(const MappingTable& table) {
+        std::string temp_path = settings.shm_export_path + ".tmp";
+        if (!write_table_file(table, temp_path, false)) {
+            return;
+        }
         
-        internal_to_external[internal_key] = external_key;
-        external_to_internal[external_key] = internal_key;
+        // Opened before the rename so the replaced file can still be flagged
+        int previous_fd = open(settings.shm_export_path.c_str(), O_RDWR | O_CLOEXEC);
+        if (rename(temp_path.c_str(), settings.shm_export_path.c_str()) == -1) {
+            log_error("Failed to publish " + settings.shm_export_path + ": " + std::string(strerror(errno)));
+            unlink(temp_path.c_str());
+        } else if (previous_fd != -1) {
+            mark_superseded(previous_fd);
+        }
+        if (previous_fd != -1) {
+            close(previous_fd);
+        }
+    }
+    
+    // Synced before the rename, so a crash or power cut leaves either the
+    // previous snapshot or the new one in place, never a torn file
+    void save_snapshot(const MappingTable& table) {
+        std::string temp_path = settings.snapshot_path + ".tmp";
+        if (!write_table_file(table, temp_path, true)) {
+            return;
+        }
+        if (rename(temp_path.c_str(), settings.snapshot_path.c_str()) == -1) {
+            log_error("Failed to save " + settings.snapshot_path + ": " + std::string(strerror(errno)));
+            unlink(temp_path.c_str());
+        }
     }
     
-    void handle_client(int client_socket) {
-        char buffer[1024];
-        ssize_t bytes_read = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
+    // Publishes the table the previous run saved, flagged stale, so lookups
+    // are answered before the kernel module provides the proc file. The
+    // first successful read of proc replaces it, even an empty one.
+    void load_snapshot() {
+        struct stat st;
+        if (stat(settings.snapshot_path.c_str(), &st) == -1) {
+            if (errno != ENOENT) {
+                log_warning("Cannot read " + settings.snapshot_path + ": " + std::string(strerror(errno)));
+            }
+            return;
+        }
+        
+        SlnatShmReader reader(settings.snapshot_path);
+        uint32_t count = 0;
+        const SlnatShmMapping* saved = reader.mapping_list(count);
+        if (!saved) {
+            log_warning("Ignoring invalid snapshot " + settings.snapshot_path);
+            return;
+        }
+        if (count == 0) {
+            return;
+        }
+        
+        auto table = std::make_shared<MappingTable>();
+        table->stale = true;
+        table->mappings.reserve(count);
+        for (uint32_t i = 0; i < count; i++) {
+            const SlnatShmMapping& entry = saved[i];
+            if (entry.prefix_len < 0 || entry.prefix_len > 128) {
+                continue;
+            }
+            NatMapping mapping;
+            mapping.interface.assign(entry.interface, strnlen(entry.interface, sizeof(entry.interface)));
+            mapping.prefix_len = entry.prefix_len;
+            memcpy(mapping.internal_addr.s6_addr, entry.internal_addr, sizeof(entry.internal_addr));
+            memcpy(mapping.external_addr.s6_addr, entry.external_addr, sizeof(entry.external_addr));
+            table->mappings.push_back(std::move(mapping));
+        }
+        build_indexes(*table);
+        
+        last_mapping_count = table->mappings.size();
+        // Continues the saved numbering, so clients that cached answers from
+        // the previous process notice every later change
+        publish_table(table, reader.generation());
+        if (!settings.shm_export_path.empty()) {
+            export_table(*table);
+        }
         
-        if (bytes_read <= 0) {
-            close(client_socket);
+        log_info("Serving ", last_mapping_count, " mappings from ", settings.snapshot_path, ", saved ",
+                 std::max<long long>(time(nullptr) - st.st_mtime, 0), "s ago, until ",
+                 settings.proc_mappings_path, " loads");
+    }
+    
+    static void retire_export(const std::string& path) {
+        int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd != -1) {
+            mark_superseded(fd);
+            close(fd);
+        }
+    }
+    
+    // Only touches files that really are exports, so a stray file at the
+    // path cannot fault the daemon
+    static void mark_superseded(int fd) {
+        struct stat st;
+        if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(SlnatShmHeader)) {
             return;
         }
         
-        buffer[bytes_read] = '\0';
+        void* mapped = mmap(nullptr, sizeof(SlnatShmHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            return;
+        }
+        SlnatShmHeader* header = static_cast<SlnatShmHeader*>(mapped);
+        if (memcmp(header->magic, SLNAT_SHM_MAGIC, sizeof(header->magic)) == 0) {
+            __atomic_store_n(&header->superseded, 1, __ATOMIC_RELEASE);
+        }
+        munmap(mapped, sizeof(SlnatShmHeader));
+    }
+    
+    static uint64_t random_instance_id() {
+        std::random_device random;
+        return (static_cast<uint64_t>(random()) << 32) | random();
+    }
+    
+    // Generations start from the wall clock in microseconds, so a daemon
+    // restarted without a snapshot never hands out a number an earlier
+    // process already used for different mappings
+    static std::shared_ptr<MappingTable> initial_table() {
+        auto table = std::make_shared<MappingTable>();
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        table->generation = static_cast<uint64_t>(now.tv_sec) * 1000000 + static_cast<uint64_t>(now.tv_nsec) / 1000;
+        return table;
+    }
+    
+    // Readers holding the previous snapshot keep it alive until they finish.
+    // The new table follows both the current one and `after`, and the
+    // generation assigned to it is returned.
+    uint64_t publish_table(std::shared_ptr<MappingTable> table, uint64_t after = 0) {
+        uint64_t generation = std::max(snapshot()->generation, after) + 1;
+        table->generation = generation;
+        std::atomic_store(&current_table, std::shared_ptr<const MappingTable>(std::move(table)));
+        return generation;
+    }
+    
+    std::shared_ptr<const MappingTable> snapshot() const {
+        return std::atomic_load(&current_table);
+    }
+    
+    // Parses one JSON request and returns the serialized response. Sets
+    // incomplete instead when the data so far is a truncated document and
+    // more may still arrive. connection is only given for stream clients,
+    // which may turn themselves into watchers. datagram marks requests from
+    // udp listeners, whose source address is unverified.
+    std::string handle_request(const std::string& data, bool final, bool& incomplete,
+                               Connection* connection = nullptr, bool datagram = false) {
+        incomplete = false;
+        auto started = std::chrono::steady_clock::now();
+        StatCommand stat = StatCommand::UNKNOWN;
+        size_t not_found = 0;
+        std::string response;
         
         try {
-            json request = json::parse(buffer);
-            json response = process_request(request);
-            
-            std::string response_str = response.dump();
-            send(client_socket, response_str.c_str(), response_str.length(), 0);
+            json request = json::parse(data);
             
+            // Batches are serialized directly instead of through a json DOM
+            std::string command = request.value("command", "");
+            stat = stat_command(command);
+            if (command == "resolve_batch" || command == "get2kip_batch") {
+                response = process_batch_request(request, command == "get2kip_batch", not_found);
+            } else if (command == "watch") {
+                response = start_watch(request, connection);
+            } else if (datagram && (command == "list_mappings" || command == "stats")) {
+                // Both answer tiny requests with kilobytes, which a spoofed
+                // source address would turn into an amplifier
+                response = json{{"error", command + " is not available on udp listeners"}}.dump();
+            } else if (command == "list_mappings") {
+                response = start_listing(request, connection);
+            } else if (thread_cache && (stat == StatCommand::RESOLVE || stat == StatCommand::GET2KIP) &&
+                       cached_lookup(stat, request, response, not_found)) {
+                // Answered from or added to the response cache
+            } else {
+                json result = process_request(request);
+                if (result.value("status", "") == "not_found") {
+                    not_found = 1;
+                }
+                response = result.dump();
+            }
+        
+        } catch (const json::parse_error& e) {
+            if (!final && e.byte > data.size()) {
+                incomplete = true;
+                return "";
+            }
+            if (thread_stats) {
+                bump(thread_stats->parse_errors);
+            }
+            json error_response = {{"error", e.what()}};
+            return error_response.dump();
+        
         } catch (const std::exception& e) {
             json error_response = {{"error", e.what()}};
-            std::string error_str = error_response.dump();
-            send(client_socket, error_str.c_str(), error_str.length(), 0);
+            response = error_response.dump();
+        }
+        
+        record_requests(stat, elapsed_ns(started), 1, not_found);
+        return response;
+    }
+    
+    // Answers a single resolve_ip or get2kip through this worker's response
+    // cache. Returns false for requests it does not handle (a missing or
+    // unparsable address), which take the uncached path and its errors.
+    bool cached_lookup(StatCommand stat, const json& request, std::string& response, size_t& not_found) {
+        auto ip_field = request.find("ip");
+        if (ip_field == request.end() || !ip_field->is_string()) {
+            return false;
+        }
+        const std::string& ip = ip_field->get_ref<const std::string&>();
+        struct in6_addr addr;
+        if (inet_pton(AF_INET6, ip.c_str(), &addr) != 1) {
+            return false;
+        }
+        
+        auto table = snapshot();
+        if (const ResponseCache::Entry* entry = thread_cache->find(stat, addr, ip, table->generation)) {
+            bump(thread_stats->cache_hits);
+            response = entry->response;
+            not_found = entry->not_found ? 1 : 0;
+            return true;
+        }
+        
+        bump(thread_stats->cache_misses);
+        json result = stat == StatCommand::RESOLVE ? resolve_ip(*table, ip) : get_global_ip(*table, ip);
+        not_found = result.value("status", "") == "not_found" ? 1 : 0;
+        response = result.dump();
+        thread_cache->store(stat, addr, ip, table->generation, response, not_found != 0);
+        return true;
+    }
+    
+    static StatCommand stat_command(const std::string& command) {
+        if (command == "resolve_ip") return StatCommand::RESOLVE;
+        if (command == "get2kip" || command == "get_global_ip") return StatCommand::GET2KIP;
+        if (command == "resolve_batch") return StatCommand::RESOLVE_BATCH;
+        if (command == "get2kip_batch") return StatCommand::GET2KIP_BATCH;
+        if (command == "ping") return StatCommand::PING;
+        if (command == "watch") return StatCommand::WATCH;
+        if (command == "list_mappings") return StatCommand::LIST_MAPPINGS;
+        if (command == "stats") return StatCommand::STATS;
+        return StatCommand::UNKNOWN;
+    }
+    
+    static uint64_t elapsed_ns(std::chrono::steady_clock::time_point started) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - started).count();
+    }
+    
+    // Records count requests answered in per_request_ns each. Batches and
+    // binary messages answered in one pass record their average.
+    static void record_requests(StatCommand command, uint64_t per_request_ns, uint64_t count, uint64_t not_found) {
+        WorkerStats* stats = thread_stats;
+        if (!stats) {
+            return;
+        }
+        WorkerStats::CommandStats& entry = stats->command(command);
+        bump(entry.requests, count);
+        if (not_found > 0) {
+            bump(entry.not_found, not_found);
+        }
+        entry.latency.record(per_request_ns, count);
+    }
+    
+    // Turns a stream connection into a feed of change notifications,
+    // filtered as described at parse_mapping_filter
+    std::string start_watch(const json& request, Connection* connection) {
+        if (!connection) {
+            return json{{"error", "watch requires a stream connection"}}.dump();
+        }
+        if (connection->watching) {
+            return json{{"error", "Connection is already watching"}}.dump();
+        }
+        
+        MappingFilter filter;
+        std::string error;
+        if (!parse_mapping_filter(request, filter, error)) {
+            return json{{"error", error}}.dump();
+        }
+        
+        // Counted before reading the generation so the reload thread records
+        // every change published after it
+        watcher_count++;
+        connection->watching = true;
+        connection->watch_filter = filter;
+        connection->watch_generation = snapshot()->generation;
+        
+        log_debug("Client watching mappings from generation ", connection->watch_generation);
+        return json{{"status", "watching"}, {"generation", connection->watch_generation}}.dump();
+    }
+    
+    // Filters are optional: "prefix" (address or address/len) matching either
+    // side of a mapping, and "interface"
+    static bool parse_mapping_filter(const json& request, MappingFilter& filter, std::string& error) {
+        std::string prefix = request.value("prefix", "");
+        if (!prefix.empty()) {
+            std::string with_len = prefix.find('/') == std::string::npos ? prefix + "/128" : prefix;
+            if (!parse_prefix(with_len.data(), with_len.size(), filter.prefix, filter.prefix_len)) {
+                error = "Invalid prefix filter: " + prefix;
+                return false;
+            }
+            filter.has_prefix = true;
+        }
+        filter.interface = request.value("interface", "");
+        return true;
+    }
+    
+    // Lists mappings sorted by internal prefix, optionally filtered. "limit"
+    // ends the page after that many mappings with a "next_cursor" to pass
+    // as "cursor" for the next one. On stream connections the listing is
+    // written out as the socket drains, so even a whole table never sits in
+    // memory as one document. Seqpacket listeners answer one page of at
+    // most MESSAGE_LIST_LIMIT mappings; udp listeners refuse listings.
+    std::string start_listing(const json& request, Connection* connection) {
+        bool streaming = connection && !connection->seqpacket;
+        if (streaming && connection->watching) {
+            return json{{"error", "Connection is already watching"}}.dump();
+        }
+        
+        std::unique_ptr<MappingListing> listing(new MappingListing());
+        std::string error;
+        if (!parse_mapping_filter(request, listing->filter, error)) {
+            return json{{"error", error}}.dump();
+        }
+        
+        listing->remaining = SIZE_MAX;
+        auto limit = request.find("limit");
+        if (limit != request.end()) {
+            if (!limit->is_number_unsigned() || limit->get<uint64_t>() == 0) {
+                return json{{"error", "Invalid limit"}}.dump();
+            }
+            listing->remaining = limit->get<uint64_t>();
+        }
+        if (!streaming) {
+            listing->remaining = std::min(listing->remaining, MESSAGE_LIST_LIMIT);
         }
         
-        close(client_socket);
+        listing->table = snapshot();
+        const MappingTable& table = *listing->table;
+        std::string cursor = request.value("cursor", "");
+        if (!cursor.empty()) {
+            NatMapping key;
+            if (!parse_prefix(cursor.data(), cursor.size(), key.internal_addr, key.prefix_len)) {
+                return json{{"error", "Invalid cursor: " + cursor}}.dump();
+            }
+            auto resume = std::upper_bound(table.order.begin(), table.order.end(), key,
+                                           [&table](const NatMapping& key, uint32_t index) {
+                return internal_prefix_less(key, table.mappings[index]);
+            });
+            listing->position = resume - table.order.begin();
+        }
+        
+        std::string out = "{\"status\":\"success\",\"generation\":" + std::to_string(table.generation) +
+                          ",\"mappings\":[";
+        if (streaming) {
+            connection->listing = std::move(listing);
+        } else {
+            append_listing(out, *listing, SIZE_MAX);
+        }
+        return out;
+    }
+    
+    // Appends listed mappings until out holds max_bytes, and the closing
+    // fields once the listing is complete. Returns whether it is.
+    static bool append_listing(std::string& out, MappingListing& listing, size_t max_bytes) {
+        const MappingTable& table = *listing.table;
+        bool page_full = false;
+        while (listing.position < table.order.size()) {
+            const NatMapping& mapping = table.mappings[table.order[listing.position]];
+            // Pages only end where the internal prefix changes, since that
+            // is where a cursor resumes
+            if (listing.remaining == 0 && internal_prefix_less(*listing.last, mapping)) {
+                page_full = true;
+                break;
+            }
+            if (out.size() >= max_bytes) {
+                return false;
+            }
+            
+            listing.position++;
+            if (!filter_matches(listing.filter, mapping)) {
+                continue;
+            }
+            out += listing.count == 0 ? "{" : ",{";
+            append_mapping_fields(out, mapping);
+            out += ",\"prefix_len\":";
+            out += std::to_string(mapping.prefix_len);
+            out += '}';
+            listing.count++;
+            listing.last = &mapping;
+            if (listing.remaining > 0) {
+                listing.remaining--;
+            }
+        }
+        
+        out += "],\"count\":";
+        out += std::to_string(listing.count);
+        if (page_full) {
+            out += ",\"next_cursor\":\"";
+            append_prefix(out, listing.last->internal_addr, listing.last->prefix_len);
+            out += '"';
+        }
+        out += '}';
+        out += listing.terminator;
+        return true;
     }
     
     json process_request(const json& request) {
@@ -462,167 +3337,374 @@ private:
             if (ip.empty()) {
                 return {{"error", "Missing IP parameter"}};
             }
-            return resolve_ip(ip);
+            return resolve_ip(*snapshot(), ip);
         } else if (command == "get_global_ip" || command == "get2kip") {
             std::string ip = request.value("ip", "");
             if (ip.empty()) {
                 return {{"error", "Missing IP parameter"}};
             }
-            return get_global_ip(ip);
+            return get_global_ip(*snapshot(), ip);
         } else if (command == "ping") {
-            return {{"status", "pong"}};
+            auto table = snapshot();
+            json pong = {{"status", "pong"}, {"generation", table->generation}, {"instance", instance_name}};
+            if (table->stale) {
+                pong["stale"] = true;
+            }
+            return pong;
+        } else if (command == "stats") {
+            return collect_stats();
         } else {
             return {{"error", "Unknown command: " + command}};
         }
     }
     
-    json resolve_ip(const std::string& ip) {
-        if (!is_valid_ipv6(ip)) {
-            return {{"error", "Invalid IPv6 address format"}};
+    // Every worker's counters summed at one point in time
+    struct StatsTotals {
+        uint64_t requests[static_cast<int>(StatCommand::COUNT)] = {};
+        uint64_t not_found[static_cast<int>(StatCommand::COUNT)] = {};
+        uint64_t buckets[static_cast<int>(StatCommand::COUNT)][LatencyHistogram::BUCKETS] = {};
+        uint64_t latency_count[static_cast<int>(StatCommand::COUNT)] = {};
+        uint64_t sum_ns[static_cast<int>(StatCommand::COUNT)] = {};
+        uint64_t max_ns[static_cast<int>(StatCommand::COUNT)] = {};
+        uint64_t parse_errors = 0;
+        uint64_t connections = 0;
+        uint64_t rejected = 0;
+        uint64_t timed_out = 0;
+        uint64_t cache_hits = 0;
+        uint64_t cache_misses = 0;
+    };
+    
+    void sum_worker_stats(StatsTotals& totals) const {
+        for (const auto& stats : worker_stats) {
+            for (int i = 0; i < static_cast<int>(StatCommand::COUNT); i++) {
+                const WorkerStats::CommandStats& entry = stats->commands[i];
+                totals.requests[i] += entry.requests.load(std::memory_order_relaxed);
+                totals.not_found[i] += entry.not_found.load(std::memory_order_relaxed);
+                for (int b = 0; b < LatencyHistogram::BUCKETS; b++) {
+                    uint64_t count = entry.latency.counts[b].load(std::memory_order_relaxed);
+                    totals.buckets[i][b] += count;
+                    totals.latency_count[i] += count;
+                }
+                totals.sum_ns[i] += entry.latency.sum_ns.load(std::memory_order_relaxed);
+                totals.max_ns[i] = std::max(totals.max_ns[i], entry.latency.max_ns.load(std::memory_order_relaxed));
+            }
+            totals.parse_errors += stats->parse_errors.load(std::memory_order_relaxed);
+            totals.connections += stats->connections.load(std::memory_order_relaxed);
+            totals.rejected += stats->rejected.load(std::memory_order_relaxed);
+            totals.timed_out += stats->timed_out.load(std::memory_order_relaxed);
+            totals.cache_hits += stats->cache_hits.load(std::memory_order_relaxed);
+            totals.cache_misses += stats->cache_misses.load(std::memory_order_relaxed);
         }
-        
-        std::lock_guard<std::mutex> lock(mappings_mutex);
-        
-        for (const auto& mapping : mappings) {
-            if (ip_matches_prefix(ip, mapping.internal_prefix, mapping.prefix_len)) {
-                std::string public_ip = remap_address(ip, mapping.internal_prefix, 
-                                                     mapping.external_prefix, mapping.prefix_len);
-                return {
-                    {"internal_ip", ip},
-                    {"public_ip", public_ip},
-                    {"interface", mapping.interface},
-                    {"status", "success"}
-                };
+    }
+    
+    // Upper bound of the bucket holding the given quantile, capped at the
+    // largest latency seen
+    static uint64_t latency_quantile(const uint64_t* buckets, uint64_t count, uint64_t max_ns, double quantile) {
+        if (count == 0) {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(quantile * count + 0.5));
+        uint64_t seen = 0;
+        for (int b = 0; b < LatencyHistogram::BUCKETS; b++) {
+            seen += buckets[b];
+            if (seen >= rank) {
+                return std::min(LatencyHistogram::bucket_limit(b), max_ns);
             }
         }
+        return max_ns;
+    }
+    
+    json collect_stats() {
+        std::unique_ptr<StatsTotals> totals(new StatsTotals());
+        sum_worker_stats(*totals);
+        auto table = snapshot();
         
-        for (const auto& mapping : mappings) {
-            if (ip_matches_prefix(ip, mapping.external_prefix, mapping.prefix_len)) {
-                std::string internal_ip = remap_address(ip, mapping.external_prefix, 
-                                                       mapping.internal_prefix, mapping.prefix_len);
-                return {
-                    {"external_ip", ip},
-                    {"internal_ip", internal_ip},
-                    {"interface", mapping.interface},
-                    {"status", "success"}
-                };
-            }
+        json commands = json::object();
+        for (int i = 0; i < static_cast<int>(StatCommand::COUNT); i++) {
+            const uint64_t* buckets = totals->buckets[i];
+            uint64_t count = totals->latency_count[i];
+            uint64_t max_ns = totals->max_ns[i];
+            commands[stat_command_name(static_cast<StatCommand>(i))] = {
+                {"requests", totals->requests[i]},
+                {"not_found", totals->not_found[i]},
+                {"latency_us", {
+                    {"mean", count ? totals->sum_ns[i] / count / 1000.0 : 0.0},
+                    {"p50", latency_quantile(buckets, count, max_ns, 0.5) / 1000.0},
+                    {"p90", latency_quantile(buckets, count, max_ns, 0.9) / 1000.0},
+                    {"p99", latency_quantile(buckets, count, max_ns, 0.99) / 1000.0},
+                    {"p999", latency_quantile(buckets, count, max_ns, 0.999) / 1000.0},
+                    {"max", max_ns / 1000.0}
+                }}
+            };
         }
         
         return {
-            {"ip", ip},
-            {"error", "IP not found in mappings"},
-            {"status", "not_found"}
+            {"status", "success"},
+            {"generation", table->generation},
+            {"instance", instance_name},
+            {"mappings", table->mappings.size()},
+            {"table_stale", table->stale},
+            {"uptime_seconds", std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::steady_clock::now() - start_time).count()},
+            {"connections", totals->connections},
+            {"rejected_connections", totals->rejected},
+            {"timed_out_connections", totals->timed_out},
+            {"io_uring_workers", uring_workers.load()},
+            {"watchers", watcher_count.load()},
+            {"parse_errors", totals->parse_errors},
+            {"log_dropped", logger.dropped()},
+            {"response_cache", {
+                {"entries_per_worker", settings.response_cache_size},
+                {"hits", totals->cache_hits},
+                {"misses", totals->cache_misses}
+            }},
+            {"reloads", {
+                {"count", reload_count.load(std::memory_order_relaxed)},
+                {"failures", reload_failures.load(std::memory_order_relaxed)},
+                {"last_duration_ms", last_reload_ns.load(std::memory_order_relaxed) / 1e6},
+                {"total_duration_ms", total_reload_ns.load(std::memory_order_relaxed) / 1e6}
+            }},
+            {"commands", commands}
         };
     }
     
-    json get_global_ip(const std::string& ip) {
-        if (!is_valid_ipv6(ip)) {
-            return {{"error", "Invalid IPv6 address format"}};
-        }
-        
-        std::lock_guard<std::mutex> lock(mappings_mutex);
-        
-        for (const auto& mapping : mappings) {
-            if (ip_matches_prefix(ip, mapping.internal_prefix, mapping.prefix_len)) {
-                std::string global_ip = remap_address(ip, mapping.internal_prefix, 
-                                                     mapping.external_prefix, mapping.prefix_len);
-                
-                struct in6_addr addr;
-                if (inet_pton(AF_INET6, global_ip.c_str(), &addr) == 1) {
-                    if ((addr.s6_addr[0] & 0xE0) == 0x20) {
-                        return {
-                            {"internal_ip", ip},
-                            {"global_ip", global_ip},
-                            {"interface", mapping.interface},
-                            {"status", "success"}
-                        };
-                    }
-                }
-            }
+    // Answers a scrape on a prometheus listener. Any GET is served the
+    // metrics; the path is not checked.
+    std::string http_metrics_response(const std::string& request) {
+        std::string status = "200 OK";
+        std::string body;
+        if (request.compare(0, 4, "GET ") == 0) {
+            body = format_metrics();
+        } else if (request.empty() || !isupper(static_cast<unsigned char>(request[0]))) {
+            status = "400 Bad Request";
+            body = "This listener serves Prometheus metrics over HTTP\n";
+        } else {
+            status = "405 Method Not Allowed";
+            body = "Only GET is supported\n";
         }
         
-        return {
-            {"ip", ip},
-            {"error", "No global unicast mapping found for " + ip},
-            {"status", "not_found"},
-            {"available_mappings", mappings.size()}
-        };
+        return "HTTP/1.0 " + status + "\r\n"
+               "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+               "Content-Length: " + std::to_string(body.size()) + "\r\n"
+               "Connection: close\r\n\r\n" + body;
     }
     
-    bool is_valid_ipv6(const std::string& ip) {
-        struct in6_addr addr;
-        return inet_pton(AF_INET6, ip.c_str(), &addr) == 1;
+    static void append_metric_header(std::string& out, const char* name, const char* type, const char* help) {
+        out += "# HELP ";
+        out += name;
+        out += ' ';
+        out += help;
+        out += "\n# TYPE ";
+        out += name;
+        out += ' ';
+        out += type;
+        out += '\n';
     }
     
-    bool ip_matches_prefix(const std::string& ip, const std::string& prefix, int prefix_len) {
-        struct in6_addr ip_addr, prefix_addr;
-        
-        if (inet_pton(AF_INET6, ip.c_str(), &ip_addr) != 1 ||
-            inet_pton(AF_INET6, prefix.c_str(), &prefix_addr) != 1) {
-            return false;
-        }
+    static void append_metric(std::string& out, const std::string& name, uint64_t value) {
+        out += name;
+        out += ' ';
+        out += std::to_string(value);
+        out += '\n';
+    }
+    
+    static void append_seconds(std::string& out, const std::string& name, uint64_t ns) {
+        char value[32];
+        snprintf(value, sizeof(value), "%.9f", ns / 1e9);
+        out += name;
+        out += ' ';
+        out += value;
+        out += '\n';
+    }
+    
+    // Histogram buckets are exported at every power of two; the finer
+    // sub-buckets only sharpen the quantiles of the stats command
+    std::string format_metrics() {
+        std::unique_ptr<StatsTotals> totals(new StatsTotals());
+        sum_worker_stats(*totals);
+        auto table = snapshot();
+        const int command_count = static_cast<int>(StatCommand::COUNT);
         
-        int bytes = prefix_len / 8;
-        int bits = prefix_len % 8;
+        std::string out;
+        out.reserve(32768);
         
-        for (int i = 0; i < bytes; i++) {
-            if (ip_addr.s6_addr[i] != prefix_addr.s6_addr[i]) {
-                return false;
-            }
+        append_metric_header(out, "slnatcd_requests_total", "counter", "Requests answered, by command.");
+        for (int i = 0; i < command_count; i++) {
+            append_metric(out, std::string("slnatcd_requests_total{command=\"") +
+                          stat_command_name(static_cast<StatCommand>(i)) + "\"}", totals->requests[i]);
+        }
+        append_metric_header(out, "slnatcd_not_found_total", "counter", "Lookups without a matching mapping, by command.");
+        for (int i = 0; i < command_count; i++) {
+            append_metric(out, std::string("slnatcd_not_found_total{command=\"") +
+                          stat_command_name(static_cast<StatCommand>(i)) + "\"}", totals->not_found[i]);
         }
         
-        if (bits > 0 && bytes < 16) {
-            uint8_t mask = (0xFF << (8 - bits)) & 0xFF;
-            if ((ip_addr.s6_addr[bytes] & mask) != (prefix_addr.s6_addr[bytes] & mask)) {
-                return false;
+        append_metric_header(out, "slnatcd_request_duration_seconds", "histogram",
+                             "Time spent answering a request, by command.");
+        for (int i = 0; i < command_count; i++) {
+            std::string label = std::string("command=\"") + stat_command_name(static_cast<StatCommand>(i)) + "\"";
+            uint64_t cumulative = totals->buckets[i][0];
+            for (int octave = 0; octave < LatencyHistogram::OCTAVES; octave++) {
+                for (int sub = 0; sub < LatencyHistogram::SUB_BUCKETS; sub++) {
+                    cumulative += totals->buckets[i][1 + octave * LatencyHistogram::SUB_BUCKETS + sub];
+                }
+                char le[32];
+                snprintf(le, sizeof(le), "%g", (1ULL << (octave + LatencyHistogram::MIN_SHIFT + 1)) / 1e9);
+                append_metric(out, "slnatcd_request_duration_seconds_bucket{" + label + ",le=\"" + le + "\"}",
+                              cumulative);
             }
+            append_metric(out, "slnatcd_request_duration_seconds_bucket{" + label + ",le=\"+Inf\"}",
+                          totals->latency_count[i]);
+            append_seconds(out, "slnatcd_request_duration_seconds_sum{" + label + "}", totals->sum_ns[i]);
+            append_metric(out, "slnatcd_request_duration_seconds_count{" + label + "}", totals->latency_count[i]);
         }
         
-        return true;
+        append_metric_header(out, "slnatcd_parse_errors_total", "counter", "Requests that could not be parsed.");
+        append_metric(out, "slnatcd_parse_errors_total", totals->parse_errors);
+        append_metric_header(out, "slnatcd_response_cache_hits_total", "counter",
+                             "Lookups answered from the response cache.");
+        append_metric(out, "slnatcd_response_cache_hits_total", totals->cache_hits);
+        append_metric_header(out, "slnatcd_response_cache_misses_total", "counter",
+                             "Cacheable lookups that had to be computed.");
+        append_metric(out, "slnatcd_response_cache_misses_total", totals->cache_misses);
+        append_metric_header(out, "slnatcd_connections", "gauge", "Open client connections.");
+        append_metric(out, "slnatcd_connections", totals->connections);
+        append_metric_header(out, "slnatcd_rejected_connections_total", "counter",
+                             "Connections turned away with a busy error at max_connections.");
+        append_metric(out, "slnatcd_rejected_connections_total", totals->rejected);
+        append_metric_header(out, "slnatcd_timed_out_connections_total", "counter",
+                             "Connections closed for missing a read or write deadline.");
+        append_metric(out, "slnatcd_timed_out_connections_total", totals->timed_out);
+        append_metric_header(out, "slnatcd_watchers", "gauge", "Connections watching for mapping changes.");
+        append_metric(out, "slnatcd_watchers", watcher_count.load());
+        append_metric_header(out, "slnatcd_mappings", "gauge", "Mappings in the current table.");
+        append_metric(out, "slnatcd_mappings", table->mappings.size());
+        append_metric_header(out, "slnatcd_table_stale", "gauge",
+                             "1 while the table is the startup snapshot rather than from the proc file.");
+        append_metric(out, "slnatcd_table_stale", table->stale ? 1 : 0);
+        append_metric_header(out, "slnatcd_generation", "gauge", "Generation of the current table.");
+        append_metric(out, "slnatcd_generation", table->generation);
+        append_metric_header(out, "slnatcd_reloads_total", "counter", "Mapping tables loaded from the proc file.");
+        append_metric(out, "slnatcd_reloads_total", reload_count.load(std::memory_order_relaxed));
+        append_metric_header(out, "slnatcd_reload_failures_total", "counter", "Failed reads of the proc file.");
+        append_metric(out, "slnatcd_reload_failures_total", reload_failures.load(std::memory_order_relaxed));
+        append_metric_header(out, "slnatcd_log_dropped_total", "counter",
+                             "Log messages dropped because the log buffer was full.");
+        append_metric(out, "slnatcd_log_dropped_total", logger.dropped());
+        append_metric_header(out, "slnatcd_reload_duration_seconds_total", "counter", "Time spent loading tables.");
+        append_seconds(out, "slnatcd_reload_duration_seconds_total", total_reload_ns.load(std::memory_order_relaxed));
+        append_metric_header(out, "slnatcd_last_reload_duration_seconds", "gauge", "Time the last table load took.");
+        append_seconds(out, "slnatcd_last_reload_duration_seconds", last_reload_ns.load(std::memory_order_relaxed));
+        append_metric_header(out, "slnatcd_uptime_seconds", "gauge", "Seconds since the daemon started.");
+        append_metric(out, "slnatcd_uptime_seconds", std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now() - start_time).count());
+        
+        return out;
     }
     
-    std::string remap_address(const std::string& ip, const std::string& old_prefix, 
-                             const std::string& new_prefix, int prefix_len) {
-        struct in6_addr ip_addr, old_prefix_addr, new_prefix_addr;
-        
-        if (inet_pton(AF_INET6, ip.c_str(), &ip_addr) != 1 ||
-            inet_pton(AF_INET6, old_prefix.c_str(), &old_prefix_addr) != 1 ||
-            inet_pton(AF_INET6, new_prefix.c_str(), &new_prefix_addr) != 1) {
-            return ip;
+    std::string process_batch_request(const json& request, bool global_only, size_t& not_found) {
+        auto ips = request.find("ips");
+        if (ips == request.end() || !ips->is_array()) {
+            return json{{"error", "Missing ips array parameter"}}.dump();
         }
         
-        int bytes = prefix_len / 8;
-        int bits = prefix_len % 8;
+        // One snapshot for the whole batch so every result is consistent
+        auto table = snapshot();
         
-        for (int i = 0; i < bytes && i < 16; i++) {
-            ip_addr.s6_addr[i] = new_prefix_addr.s6_addr[i];
+        std::string out;
+        out.reserve(64 + ips->size() * 96);
+        out += "{\"generation\":";
+        out += std::to_string(table->generation);
+        if (table->stale) {
+            out += ",\"stale\":true";
         }
+        out += ",\"results\":[";
         
-        if (bits > 0 && bytes < 16) {
-            uint8_t mask = (0xFF << (8 - bits)) & 0xFF;
-            ip_addr.s6_addr[bytes] = (new_prefix_addr.s6_addr[bytes] & mask) | 
-                                    (ip_addr.s6_addr[bytes] & ~mask);
+        bool first = true;
+        for (const auto& item : *ips) {
+            if (!first) {
+                out += ',';
+            }
+            first = false;
+            
+            const std::string* ip = item.get_ptr<const std::string*>();
+            struct in6_addr addr;
+            if (!ip || inet_pton(AF_INET6, ip->c_str(), &addr) != 1) {
+                out += "{\"ip\":";
+                append_json_string(out, ip ? *ip : item.dump());
+                out += ",\"error\":\"Invalid IPv6 address format\"}";
+                continue;
+            }
+            
+            out += "{\"ip\":";
+            append_json_string(out, *ip);
+            
+            const NatMapping* mapping = nullptr;
+            struct in6_addr mapped;
+            if (global_only) {
+                if (lookup_global(*table, addr, mapping, mapped)) {
+                    out += ",\"internal_ip\":";
+                    append_json_string(out, *ip);
+                    out += ",\"global_ip\":\"";
+                    append_ipv6(out, mapped);
+                    out += '"';
+                }
+            } else {
+                bool is_internal = false;
+                if (lookup_resolve(*table, addr, mapping, mapped, is_internal)) {
+                    out += is_internal ? ",\"internal_ip\":" : ",\"external_ip\":";
+                    append_json_string(out, *ip);
+                    out += is_internal ? ",\"public_ip\":\"" : ",\"internal_ip\":\"";
+                    append_ipv6(out, mapped);
+                    out += '"';
+                }
+            }
+            
+            if (mapping) {
+                out += ",\"interface\":";
+                append_json_string(out, mapping->interface);
+                out += ",\"status\":\"success\"}";
+            } else {
+                out += ",\"status\":\"not_found\"}";
+                not_found++;
+            }
         }
         
+        out += "],\"status\":\"success\"}";
+        return out;
+    }
+    
+    static void append_ipv6(std::string& out, const struct in6_addr& addr) {
         char result[INET6_ADDRSTRLEN];
-        if (inet_ntop(AF_INET6, &ip_addr, result, sizeof(result))) {
-            return std::string(result);
+        if (inet_ntop(AF_INET6, &addr, result, sizeof(result))) {
+            out += result;
         }
-        
-        return ip;
     }
-};
-
-SlickNatDaemon* g_daemon = nullptr;
-
-void signal_handler(int signum) {
-    std::cout << "\nReceived signal " << signum << std::endl;
-    if (g_daemon) {
-        g_daemon->stop();
+    
+    static void append_json_string(std::string& out, const std::string& value) {
+        static const char hex[] = "0123456789abcdef";
+        out += '"';
+        for (unsigned char c : value) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += static_cast<char>(c);
+            } else if (c < 0x20) {
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xF];
+            } else {
+                out += static_cast<char>(c);
+            }
+        }
+        out += '"';
+    }
+    
+    bool is_valid_ipv6(const std::string& ip) {
+        struct in6_addr addr;
+        return inet_pton(AF_INET6, ip.c_str(), &addr) == 1;
     }
-    exit(0);
-}
+
+};
 
 int main(int argc, char* argv[]) {
     std::string config_path = "/etc/slnatcd/config";
@@ -639,18 +3721,59 @@ int main(int argc, char* argv[]) {
             std::cout << "  --config PATH   Configuration file path (default: /etc/slnatcd/config)\n";
             std::cout << "  --proc PATH     Kernel proc file path (default: /proc/net/slick_nat_mappings)\n";
             std::cout << "\nConfig file options:\n";
-            std::cout << "  listen <address> <port>   Listen on specified address and port\n";
+            std::cout << "  listen <address> <port> [json|ndjson|binary|prometheus] [udp]\n";
+            std::cout << "                            Listen on specified address and port; ndjson keeps\n";
+            std::cout << "                            connections open for newline-delimited requests,\n";
+            std::cout << "                            binary serves fixed-size binary records, prometheus\n";
+            std::cout << "                            serves metrics over HTTP, udp answers one request\n";
+            std::cout << "                            or batch per datagram\n";
+            std::cout << "  listen unix:<path> [json|ndjson|binary] [seqpacket]\n";
+            std::cout << "                            Listen on a unix domain socket; seqpacket carries\n";
+            std::cout << "                            one request per message on a kept-open connection\n";
             std::cout << "  proc_path <path>          Set kernel proc file path\n";
+            std::cout << "  workers <count>           Number of request worker threads (default: CPU count)\n";
+            std::cout << "  listen_shards <n|auto>    SO_REUSEPORT sockets per TCP/UDP address; auto gives\n";
+            std::cout << "                            each worker its own (default: 1)\n";
+            std::cout << "  cpu_affinity <cpus|auto>  Pin workers to CPUs, e.g. 0-7,16-23\n";
+            std::cout << "  io_backend <epoll|io_uring>\n";
+            std::cout << "                            Network I/O backend; io_uring falls back to epoll\n";
+            std::cout << "                            when the kernel lacks it (default: epoll)\n";
+            std::cout << "  reload_interval <min_ms> [max_ms]\n";
+            std::cout << "                            Proc file poll interval; backs off from min to max\n";
+            std::cout << "                            while unchanged (default: 200 1000)\n";
+            std::cout << "  response_cache <entries>  Answers cached per worker for repeated lookups\n";
+            std::cout << "                            (default: 4096, 0 disables)\n";
+            std::cout << "  listen_backlog <count>    Pending connections queued per listener (default: 128)\n";
+            std::cout << "  max_connections <count>   Open connections before new ones get a busy error\n";
+            std::cout << "                            (default: 4096, 0 disables)\n";
+            std::cout << "  read_timeout <ms>         Time allowed for a complete request, or between\n";
+            std::cout << "                            requests (default: 30000, 0 disables)\n";
+            std::cout << "  write_timeout <ms>        Time pending output may make no progress\n";
+            std::cout << "                            (default: 10000, 0 disables)\n";
+            std::cout << "  shm_export [path]         Publish the mapping table for local readers\n";
+            std::cout << "                            (default: " << SLNAT_SHM_DEFAULT_PATH << ")\n";
+            std::cout << "  snapshot [path]           Save each table and serve it at startup until the\n";
+            std::cout << "                            proc file loads (default: " << SNAPSHOT_DEFAULT_PATH << ")\n";
+            std::cout << "  drain_timeout <ms>        Time SIGTERM gives open connections to finish\n";
+            std::cout << "                            (default: 5000)\n";
             std::cout << "  log_level <level>         Set log level (error, warning, info, debug)\n";
+            std::cout << "\nSIGHUP reloads listeners, log level and drain timeout from the config file.\n";
+            std::cout << "Listening sockets passed by systemd socket activation (LISTEN_FDS) are used\n";
+            std::cout << "for the listen directives whose address they are bound to.\n";
             return 0;
         }
     }
     
-    SlickNatDaemon daemon(config_path, proc_path);
-    g_daemon = &daemon;
+    // The daemon takes these with sigtimedwait on this thread; blocking them
+    // first keeps every thread it creates from being interrupted
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
     
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+    SlickNatDaemon daemon(config_path, proc_path);
     
     if (!daemon.start()) {
         std::cerr << "Failed to start daemon" << std::endl;
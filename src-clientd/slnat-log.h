@@ -0,0 +1,430 @@
+// SlickNat asynchronous logger
+//
+// Logging threads never format text or write to a file descriptor. A log
+// call claims a slot in a bounded lock-free ring and copies its arguments
+// into it in a compact tagged form: strings as bytes, numbers and IPv6
+// addresses as raw values. A background writer thread turns the records
+// into lines, collapses repeats of the same line and writes them to stdout
+// (info and debug) or stderr (warnings and errors) in batches. When the
+// ring is full the message is dropped and counted instead of blocking.
+
+#ifndef SLNAT_LOG_H
+#define SLNAT_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <cerrno>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+enum class LogLevel {
+    ERROR = 0,
+    WARNING = 1,
+    INFO = 2,
+    DEBUG = 3
+};
+
+// An address that is only converted to text on the writer thread
+struct LogAddress {
+    struct in6_addr addr;
+};
+
+class SlnatLogger {
+public:
+    // Slots in the ring, a power of two
+    static const size_t RING_SIZE = 2048;
+    
+    // Bytes per slot, including its header; longer messages are cut short
+    static const size_t SLOT_SIZE = 512;
+    
+    // Identical lines are written once per interval, then summarized
+    static constexpr std::chrono::milliseconds REPEAT_INTERVAL{1000};
+    
+    // Distinct lines tracked for repeats within one interval
+    static const size_t MAX_TRACKED_LINES = 256;
+    
+    SlnatLogger() : slots(new Slot[RING_SIZE]), head(0), tail(0), writer_idle(false), dropped_count(0),
+                    stopping(false), running(true), reported_drops(0) {
+        for (size_t i = 0; i < RING_SIZE; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        writer = std::thread(&SlnatLogger::run_writer, this);
+    }
+    
+    SlnatLogger(const SlnatLogger&) = delete;
+    SlnatLogger& operator=(const SlnatLogger&) = delete;
+    
+    ~SlnatLogger() {
+        stop();
+    }
+    
+    // Writes out everything queued so far and stops the writer thread.
+    // Messages logged afterwards are written synchronously.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            if (stopping) {
+                return;
+            }
+            stopping = true;
+            running.store(false, std::memory_order_release);
+        }
+        wake.notify_one();
+        writer.join();
+    }
+    
+    // Messages lost because the ring was full
+    uint64_t dropped() const {
+        return dropped_count.load(std::memory_order_relaxed);
+    }
+    
+    // parts are strings, integers or LogAddress values, concatenated
+    template <typename... Parts>
+    void log(LogLevel level, const Parts&... parts) {
+        if (!running.load(std::memory_order_acquire)) {
+            Slot record;
+            record.level = level;
+            record.length = 0;
+            record.truncated = false;
+            append_parts(record, parts...);
+            write_now(record);
+            return;
+        }
+        
+        uint64_t position = head.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[position & (RING_SIZE - 1)];
+            uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+            int64_t difference = static_cast<int64_t>(sequence - position);
+            if (difference == 0) {
+                if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                dropped_count.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+        
+        slot->level = level;
+        slot->length = 0;
+        slot->truncated = false;
+        append_parts(*slot, parts...);
+        slot->sequence.store(position + 1, std::memory_order_release);
+        
+        // Pairs with the fence in run_writer: either the writer sees this
+        // record before it sleeps, or this sees that it is asleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (writer_idle.load(std::memory_order_relaxed)) {
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex);
+            }
+            wake.notify_one();
+        }
+    }
+
+private:
+    enum PartTag : uint8_t {
+        TEXT = 1,
+        SIGNED = 2,
+        UNSIGNED = 3,
+        ADDRESS = 4
+    };
+    
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        LogLevel level;
+        uint16_t length;
+        bool truncated;
+        char data[SLOT_SIZE - 16];
+    };
+    
+    struct Repeat {
+        std::chrono::steady_clock::time_point first;
+        LogLevel level;
+        uint64_t suppressed;
+    };
+    
+    std::unique_ptr<Slot[]> slots;
+    alignas(64) std::atomic<uint64_t> head;
+    // Only touched by the writer thread
+    alignas(64) uint64_t tail;
+    
+    std::atomic<bool> writer_idle;
+    std::atomic<uint64_t> dropped_count;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::atomic<bool> running;
+    std::thread writer;
+    
+    // Writer thread state
+    std::unordered_map<std::string, Repeat> recent;
+    uint64_t reported_drops;
+    std::mutex write_mutex;
+    
+    static bool reserve(Slot& slot, size_t bytes) {
+        if (slot.length + bytes > sizeof(slot.data)) {
+            slot.truncated = true;
+            return false;
+        }
+        return true;
+    }
+    
+    static void append_text(Slot& slot, const char* text, size_t length) {
+        if (slot.length + 3u > sizeof(slot.data)) {
+            slot.truncated = true;
+            return;
+        }
+        size_t room = sizeof(slot.data) - slot.length - 3;
+        if (length > room) {
+            length = room;
+            slot.truncated = true;
+        }
+        uint16_t size = static_cast<uint16_t>(length);
+        slot.data[slot.length] = TEXT;
+        memcpy(slot.data + slot.length + 1, &size, sizeof(size));
+        memcpy(slot.data + slot.length + 3, text, length);
+        slot.length += 3 + length;
+    }
+    
+    template <typename T>
+    static void append_value(Slot& slot, PartTag tag, const T& value) {
+        if (reserve(slot, 1 + sizeof(value))) {
+            slot.data[slot.length] = tag;
+            memcpy(slot.data + slot.length + 1, &value, sizeof(value));
+            slot.length += 1 + sizeof(value);
+        }
+    }
+    
+    static void append(Slot& slot, const char* text) {
+        append_text(slot, text, strlen(text));
+    }
+    
+    static void append(Slot& slot, const std::string& text) {
+        append_text(slot, text.data(), text.size());
+    }
+    
+    static void append(Slot& slot, const LogAddress& address) {
+        append_value(slot, ADDRESS, address.addr);
+    }
+    
+    template <typename T>
+    static typename std::enable_if<std::is_integral<T>::value>::type append(Slot& slot, T value) {
+        if (std::is_signed<T>::value) {
+            append_value(slot, SIGNED, static_cast<int64_t>(value));
+        } else {
+            append_value(slot, UNSIGNED, static_cast<uint64_t>(value));
+        }
+    }
+    
+    static void append_parts(Slot&) {
+    }
+    
+    template <typename Part, typename... Parts>
+    static void append_parts(Slot& slot, const Part& part, const Parts&... parts) {
+        append(slot, part);
+        append_parts(slot, parts...);
+    }
+    
+    static const char* level_name(LogLevel level) {
+        switch (level) {
+            case LogLevel::ERROR:   return "ERROR";
+            case LogLevel::WARNING: return "WARN";
+            case LogLevel::INFO:    return "INFO";
+            case LogLevel::DEBUG:   return "DEBUG";
+            default:                return "UNKNOWN";
+        }
+    }
+    
+    static bool to_stderr(LogLevel level) {
+        return level == LogLevel::ERROR || level == LogLevel::WARNING;
+    }
+    
+    // "[LEVEL] message", without a newline
+    static std::string format(const Slot& slot) {
+        std::string line = "[";
+        line += level_name(slot.level);
+        line += "] ";
+        
+        size_t offset = 0;
+        while (offset < slot.length) {
+            uint8_t tag = static_cast<uint8_t>(slot.data[offset++]);
+            if (tag == TEXT) {
+                uint16_t size;
+                memcpy(&size, slot.data + offset, sizeof(size));
+                line.append(slot.data + offset + sizeof(size), size);
+                offset += sizeof(size) + size;
+            } else if (tag == SIGNED) {
+                int64_t value;
+                memcpy(&value, slot.data + offset, sizeof(value));
+                line += std::to_string(value);
+                offset += sizeof(value);
+            } else if (tag == UNSIGNED) {
+                uint64_t value;
+                memcpy(&value, slot.data + offset, sizeof(value));
+                line += std::to_string(value);
+                offset += sizeof(value);
+            } else if (tag == ADDRESS) {
+                struct in6_addr addr;
+                memcpy(&addr, slot.data + offset, sizeof(addr));
+                char text[INET6_ADDRSTRLEN];
+                line += inet_ntop(AF_INET6, &addr, text, sizeof(text)) ? text : "?";
+                offset += sizeof(addr);
+            } else {
+                break;
+            }
+        }
+        if (slot.truncated) {
+            line += "...";
+        }
+        return line;
+    }
+    
+    static void write_all(int fd, const std::string& text) {
+        size_t offset = 0;
+        while (offset < text.size()) {
+            ssize_t written = write(fd, text.data() + offset, text.size() - offset);
+            if (written == -1 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return;
+            }
+            offset += written;
+        }
+    }
+    
+    void write_now(const Slot& record) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        write_all(to_stderr(record.level) ? STDERR_FILENO : STDOUT_FILENO, format(record) + "\n");
+    }
+    
+    bool pending() const {
+        return slots[tail & (RING_SIZE - 1)].sequence.load(std::memory_order_acquire) == tail + 1;
+    }
+    
+    // Formats up to a ring's worth of queued records into out or err;
+    // returns how many
+    size_t drain(std::string& out, std::string& err, std::chrono::steady_clock::time_point now) {
+        size_t count = 0;
+        while (count < RING_SIZE && pending()) {
+            Slot& slot = slots[tail & (RING_SIZE - 1)];
+            LogLevel level = slot.level;
+            std::string line = format(slot);
+            slot.sequence.store(tail + RING_SIZE, std::memory_order_release);
+            tail++;
+            count++;
+            
+            auto repeat = recent.find(line);
+            if (repeat != recent.end()) {
+                repeat->second.suppressed++;
+                continue;
+            }
+            if (recent.size() >= MAX_TRACKED_LINES) {
+                // Lines seen once are only candidates; make room among them
+                forget_unrepeated();
+            }
+            if (recent.size() < MAX_TRACKED_LINES) {
+                recent.emplace(line, Repeat{now, level, 0});
+            }
+            (to_stderr(level) ? err : out) += line + "\n";
+        }
+        return count;
+    }
+    
+    void forget_unrepeated() {
+        for (auto repeat = recent.begin(); repeat != recent.end();) {
+            if (repeat->second.suppressed == 0) {
+                repeat = recent.erase(repeat);
+            } else {
+                ++repeat;
+            }
+        }
+    }
+    
+    // Summarizes repeats whose interval has ended, or all of them when
+    // flushing before exit, and reports newly dropped messages
+    void sweep(std::string& out, std::string& err, std::chrono::steady_clock::time_point now, bool flush) {
+        for (auto repeat = recent.begin(); repeat != recent.end();) {
+            if (!flush && now - repeat->second.first < REPEAT_INTERVAL) {
+                ++repeat;
+                continue;
+            }
+            if (repeat->second.suppressed > 0) {
+                (to_stderr(repeat->second.level) ? err : out) += repeat->first + " (repeated " +
+                    std::to_string(repeat->second.suppressed) + " more times)\n";
+            }
+            repeat = recent.erase(repeat);
+        }
+        
+        uint64_t dropped = dropped_count.load(std::memory_order_relaxed);
+        if (dropped != reported_drops) {
+            err += "[WARN] Dropped " + std::to_string(dropped - reported_drops) +
+                   " log messages, the log buffer was full\n";
+            reported_drops = dropped;
+        }
+    }
+    
+    void write_batch(std::string& out, std::string& err) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        if (!out.empty()) {
+            write_all(STDOUT_FILENO, out);
+            out.clear();
+        }
+        if (!err.empty()) {
+            write_all(STDERR_FILENO, err);
+            err.clear();
+        }
+    }
+    
+    void run_writer() {
+        std::string out;
+        std::string err;
+        auto last_sweep = std::chrono::steady_clock::now();
+        
+        while (true) {
+            auto now = std::chrono::steady_clock::now();
+            size_t count = drain(out, err, now);
+            if (now - last_sweep >= REPEAT_INTERVAL) {
+                sweep(out, err, now, false);
+                last_sweep = now;
+            }
+            write_batch(out, err);
+            if (count > 0) {
+                continue;
+            }
+            
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            if (stopping) {
+                break;
+            }
+            writer_idle.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!pending()) {
+                wake.wait_for(lock, REPEAT_INTERVAL);
+            }
+            writer_idle.store(false, std::memory_order_relaxed);
+        }
+        
+        while (drain(out, err, std::chrono::steady_clock::now()) > 0) {
+        }
+        sweep(out, err, std::chrono::steady_clock::now(), true);
+        write_batch(out, err);
+    }
+};
+
+#endif // SLNAT_LOG_H
@@ -0,0 +1,666 @@
+// SlickNat mapping table
+//
+// Everything the daemon knows about mappings that does not involve sockets:
+// parsing the kernel's proc file, the prefix tries built over it, diffing
+// two tables, and the resolve/get2kip lookups with their JSON answers. The
+// daemon publishes immutable MappingTable snapshots built from these
+// functions; the microbenchmarks in src-bench/ time them in isolation.
+
+#ifndef SLNAT_TABLE_H
+#define SLNAT_TABLE_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <nlohmann/json.hpp>
+#include "../src-common/slnat-shm.h"
+
+// Compare the first prefix_len bits of two IPv6 addresses
+inline bool prefix_equal(const struct in6_addr& a, const struct in6_addr& b, int prefix_len) {
+    int bytes = prefix_len / 8;
+    int bits = prefix_len % 8;
+    
+    if (memcmp(a.s6_addr, b.s6_addr, bytes) != 0) {
+        return false;
+    }
+    
+    if (bits > 0 && bytes < 16) {
+        uint8_t mask = (0xFF << (8 - bits)) & 0xFF;
+        if ((a.s6_addr[bytes] & mask) != (b.s6_addr[bytes] & mask)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+// Copy the first prefix_len bits of new_prefix into addr, keeping the host bits
+inline void remap_prefix(struct in6_addr& addr, const struct in6_addr& new_prefix, int prefix_len) {
+    int bytes = prefix_len / 8;
+    int bits = prefix_len % 8;
+    
+    memcpy(addr.s6_addr, new_prefix.s6_addr, bytes);
+    
+    if (bits > 0 && bytes < 16) {
+        uint8_t mask = (0xFF << (8 - bits)) & 0xFF;
+        addr.s6_addr[bytes] = (new_prefix.s6_addr[bytes] & mask) | (addr.s6_addr[bytes] & ~mask);
+    }
+}
+
+// Path-compressed binary trie over IPv6 prefixes for longest-prefix match.
+// Each node holds a prefix; children branch on the first bit past it, and
+// single-child chains are collapsed so a lookup visits at most 129 nodes
+// regardless of how many prefixes are stored.
+class PrefixTrie {
+public:
+    PrefixTrie() {
+        clear();
+    }
+    
+    void clear() {
+        nodes.clear();
+        value_next.clear();
+        nodes.push_back(make_node(in6addr_any, 0));
+    }
+    
+    // A trie of n prefixes never needs more than 2n nodes
+    void reserve(size_t prefix_count) {
+        nodes.reserve(prefix_count * 2 + 1);
+        value_next.reserve(prefix_count);
+    }
+    
+    // Values stored under the same prefix are kept in insertion order
+    void insert(const struct in6_addr& prefix, int prefix_len, uint32_t value) {
+        struct in6_addr key = masked(prefix, prefix_len);
+        int32_t cur = 0;
+        
+        while (true) {
+            if (nodes[cur].prefix_len == prefix_len) {
+                attach_value(cur, value);
+                return;
+            }
+            
+            int bit = get_bit(key, nodes[cur].prefix_len);
+            int32_t child = nodes[cur].child[bit];
+            
+            if (child == -1) {
+                int32_t leaf = add_node(key, prefix_len);
+                attach_value(leaf, value);
+                nodes[cur].child[bit] = leaf;
+                return;
+            }
+            
+            int child_len = nodes[child].prefix_len;
+            int common = common_prefix_len(key, nodes[child].key, std::min(prefix_len, child_len));
+            
+            if (common == child_len) {
+                cur = child;
+                continue;
+            }
+            
+            if (common == prefix_len) {
+                // New prefix sits between cur and child
+                int32_t node = add_node(key, prefix_len);
+                attach_value(node, value);
+                nodes[node].child[get_bit(nodes[child].key, prefix_len)] = child;
+                nodes[cur].child[bit] = node;
+                return;
+            }
+            
+            // Prefixes diverge below both lengths: split with a valueless node
+            int32_t split = add_node(masked(key, common), common);
+            int32_t leaf = add_node(key, prefix_len);
+            attach_value(leaf, value);
+            nodes[split].child[get_bit(nodes[child].key, common)] = child;
+            nodes[split].child[get_bit(key, common)] = leaf;
+            nodes[cur].child[bit] = split;
+            return;
+        }
+    }
+    
+    // Calls visit(value) for every stored prefix covering addr, longest
+    // prefix first. Stops early and returns true once visit returns true.
+    template <typename Visitor>
+    bool visit_matches(const struct in6_addr& addr, Visitor visit) const {
+        int32_t path[129];
+        int depth = 0;
+        int32_t cur = 0;
+        
+        while (true) {
+            const Node& node = nodes[cur];
+            if (node.value_head != -1) {
+                path[depth++] = cur;
+            }
+            if (node.prefix_len == 128) {
+                break;
+            }
+            
+            int32_t child = node.child[get_bit(addr, node.prefix_len)];
+            if (child == -1 || !prefix_equal(addr, nodes[child].key, nodes[child].prefix_len)) {
+                break;
+            }
+            cur = child;
+        }
+        
+        while (depth > 0) {
+            for (int32_t v = nodes[path[--depth]].value_head; v != -1; v = value_next[v]) {
+                if (visit(static_cast<uint32_t>(v))) {
+                    return true;
+                }
+            }
+        }
+        
+        return false;
+    }
+    
+    bool longest_match(const struct in6_addr& addr, uint32_t& value) const {
+        return visit_matches(addr, [&value](uint32_t v) {
+            value = v;
+            return true;
+        });
+    }
+    
+    size_t node_count() const {
+        return nodes.size();
+    }
+    
+    // Flattened copies for the shared-memory export. Values without a
+    // successor, or never inserted, are written as -1.
+    void export_nodes(SlnatShmNode* out) const {
+        for (size_t i = 0; i < nodes.size(); i++) {
+            memcpy(out[i].key, nodes[i].key.s6_addr, sizeof(out[i].key));
+            out[i].prefix_len = nodes[i].prefix_len;
+            out[i].child[0] = nodes[i].child[0];
+            out[i].child[1] = nodes[i].child[1];
+            out[i].value_head = nodes[i].value_head;
+        }
+    }
+    
+    void export_values(int32_t* out, size_t value_count) const {
+        for (size_t i = 0; i < value_count; i++) {
+            out[i] = i < value_next.size() ? value_next[i] : -1;
+        }
+    }
+
+private:
+    struct Node {
+        struct in6_addr key;
+        int prefix_len;
+        int32_t child[2];
+        int32_t value_head;
+        int32_t value_tail;
+    };
+    
+    std::vector<Node> nodes;
+    std::vector<int32_t> value_next;
+    
+    static Node make_node(const struct in6_addr& key, int prefix_len) {
+        return Node{key, prefix_len, {-1, -1}, -1, -1};
+    }
+    
+    int32_t add_node(const struct in6_addr& key, int prefix_len) {
+        nodes.push_back(make_node(key, prefix_len));
+        return static_cast<int32_t>(nodes.size() - 1);
+    }
+    
+    void attach_value(int32_t node, uint32_t value) {
+        if (value >= value_next.size()) {
+            value_next.resize(value + 1, -1);
+        }
+        value_next[value] = -1;
+        
+        if (nodes[node].value_tail == -1) {
+            nodes[node].value_head = static_cast<int32_t>(value);
+        } else {
+            value_next[nodes[node].value_tail] = static_cast<int32_t>(value);
+        }
+        nodes[node].value_tail = static_cast<int32_t>(value);
+    }
+    
+    static int get_bit(const struct in6_addr& addr, int index) {
+        return (addr.s6_addr[index / 8] >> (7 - index % 8)) & 1;
+    }
+    
+    static struct in6_addr masked(const struct in6_addr& addr, int prefix_len) {
+        struct in6_addr result = in6addr_any;
+        remap_prefix(result, addr, prefix_len);
+        return result;
+    }
+    
+    static int common_prefix_len(const struct in6_addr& a, const struct in6_addr& b, int limit) {
+        int len = 0;
+        for (int i = 0; i < 16 && len < limit; i++) {
+            uint8_t diff = a.s6_addr[i] ^ b.s6_addr[i];
+            if (diff == 0) {
+                len += 8;
+                continue;
+            }
+            len += __builtin_clz(diff) - 24;
+            break;
+        }
+        return std::min(len, limit);
+    }
+};
+
+struct NatMapping {
+    std::string interface;
+    int prefix_len;
+    struct in6_addr internal_addr;
+    struct in6_addr external_addr;
+};
+
+// Immutable once published; reload builds a new table and swaps it in
+struct MappingTable {
+    uint64_t generation = 0;
+    bool stale = false;                 // Loaded from the startup snapshot, not yet from proc
+    std::vector<NatMapping> mappings;
+    std::vector<uint32_t> order;        // Mapping indexes sorted by mapping_less
+    PrefixTrie internal_index;
+    PrefixTrie external_index;
+};
+
+// Mappings with the same internal prefix in both tables but a different
+// external prefix or interface count as changed rather than added+removed
+struct TableDiff {
+    std::vector<uint32_t> added;                            // Indexes into the new table
+    std::vector<uint32_t> removed;                          // Indexes into the old table
+    std::vector<std::pair<uint32_t, uint32_t>> changed;     // Old index, new index
+};
+
+enum class ParseResult {
+    OK,
+    SKIP,           // Blank line or comment
+    MALFORMED
+};
+
+inline bool parse_prefix(const char* token, size_t length, struct in6_addr& addr, int& prefix_len) {
+    const char* slash = static_cast<const char*>(memchr(token, '/', length));
+    if (!slash) {
+        return false;
+    }
+    
+    size_t addr_length = slash - token;
+    char addr_str[INET6_ADDRSTRLEN];
+    if (addr_length == 0 || addr_length >= sizeof(addr_str)) {
+        return false;
+    }
+    memcpy(addr_str, token, addr_length);
+    addr_str[addr_length] = '\0';
+    if (inet_pton(AF_INET6, addr_str, &addr) != 1) {
+        return false;
+    }
+    
+    const char* digits = slash + 1;
+    const char* digits_end = token + length;
+    if (digits == digits_end || digits_end - digits > 3) {
+        return false;
+    }
+    prefix_len = 0;
+    for (const char* d = digits; d < digits_end; d++) {
+        if (*d < '0' || *d > '9') {
+            return false;
+        }
+        prefix_len = prefix_len * 10 + (*d - '0');
+    }
+    return prefix_len <= 128;
+}
+
+// Parses "interface internal_prefix/len -> external_prefix/len" in
+// place. Only the interface name is copied out of the line.
+inline ParseResult parse_mapping_line(const char* begin, const char* end, NatMapping& mapping) {
+    const char* tokens[4];
+    size_t lengths[4];
+    int count = 0;
+    
+    const char* p = begin;
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
+        if (count == 0 && *p == '#') {
+            return ParseResult::SKIP;
+        }
+        if (count == 4) {
+            return ParseResult::MALFORMED;
+        }
+        
+        const char* token = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r') {
+            p++;
+        }
+        tokens[count] = token;
+        lengths[count] = p - token;
+        count++;
+    }
+    
+    if (count == 0) {
+        return ParseResult::SKIP;
+    }
+    if (count != 4 || lengths[2] != 2 || tokens[2][0] != '-' || tokens[2][1] != '>') {
+        return ParseResult::MALFORMED;
+    }
+    
+    int internal_len;
+    int external_len;
+    if (!parse_prefix(tokens[1], lengths[1], mapping.internal_addr, internal_len) ||
+        !parse_prefix(tokens[3], lengths[3], mapping.external_addr, external_len)) {
+        return ParseResult::MALFORMED;
+    }
+    
+    mapping.interface.assign(tokens[0], lengths[0]);
+    mapping.prefix_len = internal_len;
+    return ParseResult::OK;
+}
+
+// Parses a whole mapping file into table.mappings, calling
+// on_malformed(line_number, begin, end) for every line that does not parse.
+// Returns the number of malformed lines. Indexes are not built.
+template <typename MalformedHandler>
+size_t parse_mappings(const std::string& content, MappingTable& table, MalformedHandler on_malformed) {
+    const char* data = content.data();
+    const char* data_end = data + content.size();
+    int line_number = 0;
+    size_t malformed = 0;
+    
+    while (data < data_end) {
+        const char* line_end = static_cast<const char*>(memchr(data, '\n', data_end - data));
+        if (!line_end) {
+            line_end = data_end;
+        }
+        const char* line = data;
+        data = line_end + 1;
+        line_number++;
+        
+        NatMapping mapping;
+        ParseResult result = parse_mapping_line(line, line_end, mapping);
+        if (result == ParseResult::SKIP) {
+            continue;
+        }
+        if (result == ParseResult::MALFORMED) {
+            malformed++;
+            on_malformed(line_number, line, line_end);
+            continue;
+        }
+        
+        table.mappings.push_back(std::move(mapping));
+    }
+    
+    return malformed;
+}
+
+inline bool mapping_less(const NatMapping& a, const NatMapping& b) {
+    int cmp = memcmp(&a.internal_addr, &b.internal_addr, sizeof(a.internal_addr));
+    if (cmp != 0) {
+        return cmp < 0;
+    }
+    if (a.prefix_len != b.prefix_len) {
+        return a.prefix_len < b.prefix_len;
+    }
+    cmp = memcmp(&a.external_addr, &b.external_addr, sizeof(a.external_addr));
+    if (cmp != 0) {
+        return cmp < 0;
+    }
+    return a.interface < b.interface;
+}
+
+inline bool internal_prefix_less(const NatMapping& a, const NatMapping& b) {
+    int cmp = memcmp(&a.internal_addr, &b.internal_addr, sizeof(a.internal_addr));
+    if (cmp != 0) {
+        return cmp < 0;
+    }
+    return a.prefix_len < b.prefix_len;
+}
+
+inline void build_indexes(MappingTable& table) {
+    table.internal_index.reserve(table.mappings.size());
+    table.external_index.reserve(table.mappings.size());
+    table.order.resize(table.mappings.size());
+    
+    for (size_t i = 0; i < table.mappings.size(); i++) {
+        const NatMapping& mapping = table.mappings[i];
+        table.internal_index.insert(mapping.internal_addr, mapping.prefix_len, static_cast<uint32_t>(i));
+        table.external_index.insert(mapping.external_addr, mapping.prefix_len, static_cast<uint32_t>(i));
+        table.order[i] = static_cast<uint32_t>(i);
+    }
+    
+    std::sort(table.order.begin(), table.order.end(), [&table](uint32_t a, uint32_t b) {
+        return mapping_less(table.mappings[a], table.mappings[b]);
+    });
+}
+
+// Merge-walks both tables in sorted order to find mappings that only
+// exist in one of them, then pairs up those sharing an internal prefix.
+// Both tables must have been through build_indexes.
+inline void diff_tables(const MappingTable& before, const MappingTable& after, TableDiff& diff) {
+    const std::vector<uint32_t>& old_order = before.order;
+    const std::vector<uint32_t>& new_order = after.order;
+    
+    std::vector<uint32_t> only_old;
+    std::vector<uint32_t> only_new;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < old_order.size() || j < new_order.size()) {
+        if (j == new_order.size() ||
+            (i < old_order.size() && mapping_less(before.mappings[old_order[i]], after.mappings[new_order[j]]))) {
+            only_old.push_back(old_order[i++]);
+        } else if (i == old_order.size() ||
+                   mapping_less(after.mappings[new_order[j]], before.mappings[old_order[i]])) {
+            only_new.push_back(new_order[j++]);
+        } else {
+            i++;
+            j++;
+        }
+    }
+    
+    // Both lists are still sorted by internal prefix first
+    i = 0;
+    j = 0;
+    while (i < only_old.size() || j < only_new.size()) {
+        if (j == only_new.size() ||
+            (i < only_old.size() && internal_prefix_less(before.mappings[only_old[i]], after.mappings[only_new[j]]))) {
+            diff.removed.push_back(only_old[i++]);
+        } else if (i == only_old.size() ||
+                   internal_prefix_less(after.mappings[only_new[j]], before.mappings[only_old[i]])) {
+            diff.added.push_back(only_new[j++]);
+        } else {
+            diff.changed.emplace_back(only_old[i++], only_new[j++]);
+        }
+    }
+}
+
+// Reads a whole mapping file into content, reusing its buffer
+inline bool read_mapping_file(const std::string& path, std::string& content) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    
+    // Proc files report no size, so size the reused buffer from the last
+    // read and keep reading until EOF
+    size_t used = 0;
+    content.resize(std::max<size_t>(content.capacity(), 65536));
+    while (true) {
+        if (content.size() < used + 4096) {
+            content.resize(content.size() * 2);
+        }
+        ssize_t bytes_read = read(fd, &content[used], content.size() - used);
+        if (bytes_read == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_read <= 0) {
+            close(fd);
+            content.resize(used);
+            return bytes_read == 0;
+        }
+        used += bytes_read;
+    }
+}
+
+inline uint64_t content_hash(const std::string& content) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : content) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+inline std::string format_ipv6(const struct in6_addr& addr) {
+    char result[INET6_ADDRSTRLEN];
+    if (inet_ntop(AF_INET6, &addr, result, sizeof(result))) {
+        return std::string(result);
+    }
+    return "";
+}
+
+// Longest internal match first, then longest external match. Sets
+// is_internal to tell which direction mapped is in.
+inline bool lookup_resolve(const MappingTable& table, const struct in6_addr& addr,
+                           const NatMapping*& mapping, struct in6_addr& mapped, bool& is_internal) {
+    uint32_t index;
+    if (table.internal_index.longest_match(addr, index)) {
+        mapping = &table.mappings[index];
+        mapped = addr;
+        remap_prefix(mapped, mapping->external_addr, mapping->prefix_len);
+        is_internal = true;
+        return true;
+    }
+    
+    if (table.external_index.longest_match(addr, index)) {
+        mapping = &table.mappings[index];
+        mapped = addr;
+        remap_prefix(mapped, mapping->internal_addr, mapping->prefix_len);
+        is_internal = false;
+        return true;
+    }
+    
+    return false;
+}
+
+// Longest matching internal prefix whose mapped address is 2000::/3
+inline bool lookup_global(const MappingTable& table, const struct in6_addr& addr,
+                          const NatMapping*& mapping, struct in6_addr& global_addr) {
+    return table.internal_index.visit_matches(addr, [&](uint32_t index) {
+        const NatMapping& candidate = table.mappings[index];
+        global_addr = addr;
+        remap_prefix(global_addr, candidate.external_addr, candidate.prefix_len);
+        if ((global_addr.s6_addr[0] & 0xE0) == 0x20) {
+            mapping = &candidate;
+            return true;
+        }
+        return false;
+    });
+}
+
+// Answers from a table restored from the startup snapshot say so, since
+// the mappings may have changed while the daemon was down
+inline nlohmann::json mark_stale(const MappingTable& table, nlohmann::json result) {
+    if (table.stale) {
+        result["stale"] = true;
+    }
+    return result;
+}
+
+inline nlohmann::json resolve_ip(const MappingTable& table, const std::string& ip) {
+    struct in6_addr addr;
+    if (inet_pton(AF_INET6, ip.c_str(), &addr) != 1) {
+        return {{"error", "Invalid IPv6 address format"}};
+    }
+    
+    const NatMapping* mapping = nullptr;
+    struct in6_addr mapped;
+    bool is_internal = false;
+    if (lookup_resolve(table, addr, mapping, mapped, is_internal)) {
+        if (is_internal) {
+            return mark_stale(table, {
+                {"internal_ip", ip},
+                {"public_ip", format_ipv6(mapped)},
+                {"interface", mapping->interface},
+                {"generation", table.generation},
+                {"status", "success"}
+            });
+        }
+        return mark_stale(table, {
+            {"external_ip", ip},
+            {"internal_ip", format_ipv6(mapped)},
+            {"interface", mapping->interface},
+            {"generation", table.generation},
+            {"status", "success"}
+        });
+    }
+    
+    return mark_stale(table, {
+        {"ip", ip},
+        {"error", "IP not found in mappings"},
+        {"generation", table.generation},
+        {"status", "not_found"}
+    });
+}
+
+inline nlohmann::json get_global_ip(const MappingTable& table, const std::string& ip) {
+    struct in6_addr addr;
+    if (inet_pton(AF_INET6, ip.c_str(), &addr) != 1) {
+        return {{"error", "Invalid IPv6 address format"}};
+    }
+    
+    const NatMapping* mapping = nullptr;
+    struct in6_addr global_addr;
+    if (lookup_global(table, addr, mapping, global_addr)) {
+        return mark_stale(table, {
+            {"internal_ip", ip},
+            {"global_ip", format_ipv6(global_addr)},
+            {"interface", mapping->interface},
+            {"generation", table.generation},
+            {"status", "success"}
+        });
+    }
+    
+    return mark_stale(table, {
+        {"ip", ip},
+        {"error", "No global unicast mapping found for " + ip},
+        {"status", "not_found"},
+        {"generation", table.generation},
+        {"available_mappings", table.mappings.size()}
+    });
+}
+
+inline bool ip_matches_prefix(const std::string& ip, const std::string& prefix, int prefix_len) {
+    struct in6_addr ip_addr, prefix_addr;
+    
+    if (inet_pton(AF_INET6, ip.c_str(), &ip_addr) != 1 ||
+        inet_pton(AF_INET6, prefix.c_str(), &prefix_addr) != 1) {
+        return false;
+    }
+    
+    return prefix_equal(ip_addr, prefix_addr, prefix_len);
+}
+
+inline std::string remap_address(const std::string& ip, const std::string& old_prefix,
+                                 const std::string& new_prefix, int prefix_len) {
+    struct in6_addr ip_addr, old_prefix_addr, new_prefix_addr;
+    
+    if (inet_pton(AF_INET6, ip.c_str(), &ip_addr) != 1 ||
+        inet_pton(AF_INET6, old_prefix.c_str(), &old_prefix_addr) != 1 ||
+        inet_pton(AF_INET6, new_prefix.c_str(), &new_prefix_addr) != 1) {
+        return ip;
+    }
+    
+    remap_prefix(ip_addr, new_prefix_addr, prefix_len);
+    
+    std::string result = format_ipv6(ip_addr);
+    return result.empty() ? ip : result;
+}
+
+#endif // SLNAT_TABLE_H
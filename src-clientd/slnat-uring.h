@@ -0,0 +1,309 @@
+// SlickNat io_uring ring
+//
+// A minimal io_uring wrapper over the raw system calls, so the daemon's
+// io_uring backend needs no liburing: ring setup and mapping, SQE
+// allocation, batched submission with a bounded wait, CQE iteration and one
+// provided-buffer ring for multishot recv. Each ring belongs to a single
+// worker thread and is never shared.
+//
+// Built when <linux/io_uring.h> is available unless SLNAT_NO_IO_URING is
+// defined; SLNAT_IO_URING tells the daemon whether it was.
+
+#ifndef SLNAT_URING_H
+#define SLNAT_URING_H
+
+#if !defined(SLNAT_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define SLNAT_IO_URING 1
+#endif
+#endif
+
+#ifdef SLNAT_IO_URING
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <linux/io_uring.h>
+
+// Multishot recv needs Linux 6.0; older kernels reject it per request
+inline bool uring_kernel_supported() {
+    struct utsname name;
+    int major = 0;
+    if (uname(&name) != 0 || sscanf(name.release, "%d.", &major) != 1) {
+        return false;
+    }
+    return major >= 6;
+}
+
+class UringRing {
+public:
+    UringRing() = default;
+    UringRing(const UringRing&) = delete;
+    UringRing& operator=(const UringRing&) = delete;
+    
+    ~UringRing() {
+        release();
+    }
+    
+    // Sets up a ring with room for entries submissions. Returns 0 or a
+    // negative errno.
+    int init(unsigned entries) {
+        // Newer flags first; each retry drops what an older kernel rejects
+        static const unsigned flag_sets[] = {
+            IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+            IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN,
+            0
+        };
+        struct io_uring_params params;
+        for (unsigned flags : flag_sets) {
+            memset(&params, 0, sizeof(params));
+            params.flags = flags;
+            ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+            if (ring_fd >= 0 || errno != EINVAL) {
+                break;
+            }
+        }
+        if (ring_fd < 0) {
+            return -errno;
+        }
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP) ||
+            !(params.features & IORING_FEAT_EXT_ARG)) {
+            release();
+            return -ENOSYS;
+        }
+        defer_taskrun = params.flags & IORING_SETUP_DEFER_TASKRUN;
+        
+        ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                             params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+        ring_ptr = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                        IORING_OFF_SQ_RING);
+        if (ring_ptr == MAP_FAILED) {
+            ring_ptr = nullptr;
+            int error = -errno;
+            release();
+            return error;
+        }
+        sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        void* sqes_ptr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                              IORING_OFF_SQES);
+        if (sqes_ptr == MAP_FAILED) {
+            int error = -errno;
+            release();
+            return error;
+        }
+        sqes = static_cast<struct io_uring_sqe*>(sqes_ptr);
+        
+        char* base = static_cast<char*>(ring_ptr);
+        sq_head = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+        sq_entries = params.sq_entries;
+        cq_head = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(base + params.cq_off.cqes);
+        
+        // SQ slots map one to one onto SQEs, so the index array is fixed
+        unsigned* array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+        for (unsigned i = 0; i < sq_entries; i++) {
+            array[i] = i;
+        }
+        local_tail = *sq_tail;
+        return 0;
+    }
+    
+    // Returns 0 if the kernel implements every opcode in ops
+    int probe(const uint8_t* ops, size_t count) {
+        size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+        std::string storage(size, '\0');
+        struct io_uring_probe* result = reinterpret_cast<struct io_uring_probe*>(&storage[0]);
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, result, 256) < 0) {
+            return -errno;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (ops[i] > result->last_op || !(result->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+                return -EOPNOTSUPP;
+            }
+        }
+        return 0;
+    }
+    
+    // Registers buffer group group with count buffers of size bytes each,
+    // all handed to the kernel. count must be a power of two.
+    int setup_buffers(uint16_t group, unsigned count, unsigned size) {
+        buffer_ring_size = count * sizeof(struct io_uring_buf);
+        void* ring = mmap(nullptr, buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) {
+            return -errno;
+        }
+        buffer_ring = static_cast<struct io_uring_buf_ring*>(ring);
+        buffer_storage.assign(static_cast<size_t>(count) * size, '\0');
+        buffer_count = count;
+        buffer_size = size;
+        buffer_group = group;
+        
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(buffer_ring);
+        reg.ring_entries = count;
+        reg.bgid = group;
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            int error = -errno;
+            munmap(buffer_ring, buffer_ring_size);
+            buffer_ring = nullptr;
+            return error;
+        }
+        
+        buffer_tail = 0;
+        for (unsigned bid = 0; bid < count; bid++) {
+            add_buffer(bid);
+        }
+        __atomic_store_n(&buffer_ring->tail, buffer_tail, __ATOMIC_RELEASE);
+        return 0;
+    }
+    
+    const char* buffer(unsigned bid) const {
+        return &buffer_storage[static_cast<size_t>(bid) * buffer_size];
+    }
+    
+    // Hands a buffer the kernel filled back for another recv
+    void recycle_buffer(unsigned bid) {
+        add_buffer(bid);
+        __atomic_store_n(&buffer_ring->tail, buffer_tail, __ATOMIC_RELEASE);
+    }
+    
+    uint16_t group() const {
+        return buffer_group;
+    }
+    
+    // Returns a zeroed SQE, submitting queued ones first if the ring is full
+    struct io_uring_sqe* get_sqe() {
+        if (local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+            enter(0, 0, nullptr);
+            if (local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+                return nullptr;
+            }
+        }
+        struct io_uring_sqe* sqe = &sqes[local_tail & sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        local_tail++;
+        return sqe;
+    }
+    
+    // Submits everything queued and, unless completions are already
+    // waiting, blocks for one or until timeout_ms passes. One system call.
+    int submit_and_wait(int timeout_ms) {
+        bool ready = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) != *cq_head;
+        if (ready && !defer_taskrun) {
+            return *sq_tail == local_tail ? 0 : enter(0, 0, nullptr);
+        }
+        
+        struct __kernel_timespec timeout;
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = reinterpret_cast<uint64_t>(&timeout);
+        return enter(ready ? 0 : 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg);
+    }
+    
+    // Calls handle for every completion and releases them all at once
+    template <typename Handler>
+    unsigned for_each_completion(Handler handle) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        unsigned seen = 0;
+        for (; head != tail; head++, seen++) {
+            handle(cqes[head & cq_mask]);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return seen;
+    }
+
+private:
+    int ring_fd = -1;
+    bool defer_taskrun = false;
+    void* ring_ptr = nullptr;
+    size_t ring_size = 0;
+    struct io_uring_sqe* sqes = nullptr;
+    size_t sqes_size = 0;
+    
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned local_tail = 0;    // SQEs handed out, published to sq_tail on submit
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    struct io_uring_cqe* cqes = nullptr;
+    
+    struct io_uring_buf_ring* buffer_ring = nullptr;
+    size_t buffer_ring_size = 0;
+    std::string buffer_storage;
+    unsigned buffer_count = 0;
+    unsigned buffer_size = 0;
+    uint16_t buffer_group = 0;
+    uint16_t buffer_tail = 0;
+    
+    // Entries are indexed from the ring's start: compiled as C++, the
+    // header's bufs member sits behind an empty struct at offset 8
+    void add_buffer(unsigned bid) {
+        struct io_uring_buf* bufs = reinterpret_cast<struct io_uring_buf*>(buffer_ring);
+        struct io_uring_buf* buf = &bufs[buffer_tail & (buffer_count - 1)];
+        buf->addr = reinterpret_cast<uint64_t>(buffer(bid));
+        buf->len = buffer_size;
+        buf->bid = static_cast<uint16_t>(bid);
+        buffer_tail++;
+    }
+    
+    int enter(unsigned wait_for, unsigned flags, struct io_uring_getevents_arg* arg) {
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+        while (true) {
+            unsigned to_submit = local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+            long result = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_for, flags, arg,
+                                  arg ? sizeof(*arg) : 0);
+            if (result >= 0) {
+                return 0;
+            }
+            if (errno == ETIME || errno == EBUSY) {
+                return 0;
+            }
+            if (errno != EINTR) {
+                return -errno;
+            }
+        }
+    }
+    
+    // The kernel drops its buffer registration with the ring, so the
+    // buffer ring is only unmapped once the ring is closed
+    void release() {
+        if (ring_fd >= 0) {
+            close(ring_fd);
+            ring_fd = -1;
+        }
+        if (buffer_ring) {
+            munmap(buffer_ring, buffer_ring_size);
+            buffer_ring = nullptr;
+        }
+        if (sqes) {
+            munmap(sqes, sqes_size);
+            sqes = nullptr;
+        }
+        if (ring_ptr) {
+            munmap(ring_ptr, ring_size);
+            ring_ptr = nullptr;
+        }
+    }
+};
+
+#endif // SLNAT_IO_URING
+
+#endif // SLNAT_URING_H
@@ -0,0 +1,113 @@
+// SlickNat compact binary protocol
+//
+// Fixed-size records exchanged over a persistent TCP connection on a
+// listener configured with the "binary" keyword. Clients may pipeline any
+// number of requests; responses come back in request order. Multi-byte
+// integers are in network byte order.
+
+#ifndef SLNAT_BINARY_H
+#define SLNAT_BINARY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <endian.h>
+
+#define SLNAT_BINARY_VERSION 1
+
+enum SlnatBinaryCommand : uint8_t {
+    SLNAT_CMD_PING    = 0,
+    SLNAT_CMD_RESOLVE = 1,
+    SLNAT_CMD_GET2KIP = 2
+};
+
+enum SlnatBinaryStatus : uint8_t {
+    SLNAT_STATUS_SUCCESS     = 0,
+    SLNAT_STATUS_NOT_FOUND   = 1,
+    SLNAT_STATUS_BAD_REQUEST = 2,
+    SLNAT_STATUS_BUSY        = 3    // Unsolicited, id 0: connection limit reached
+};
+
+// Set in response flags when a resolve matched an external prefix, so
+// addr holds the internal address rather than the public one
+#define SLNAT_FLAG_EXTERNAL_MATCH 0x01
+
+// Set in every response while the daemon still serves the snapshot saved
+// by its previous run because the proc file has not loaded yet
+#define SLNAT_FLAG_STALE 0x02
+
+#pragma pack(push, 1)
+
+struct SlnatBinaryRequest {
+    uint8_t version;
+    uint8_t command;
+    uint16_t reserved;
+    uint32_t id;            // Echoed back in the response
+    uint8_t addr[16];
+};
+
+struct SlnatBinaryResponse {
+    uint8_t version;
+    uint8_t status;
+    uint8_t flags;
+    uint8_t reserved;
+    uint32_t id;
+    uint64_t generation;    // Mapping table snapshot that answered
+    uint8_t addr[16];       // Mapped address on success; for ping, the
+                            // daemon's instance id in the first 8 bytes
+    char interface[16];     // NUL-padded interface name
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(SlnatBinaryRequest) == 24, "binary request must be 24 bytes");
+static_assert(sizeof(SlnatBinaryResponse) == 48, "binary response must be 48 bytes");
+
+inline SlnatBinaryRequest slnat_make_binary_request(uint8_t command, uint32_t id, const struct in6_addr& addr) {
+    SlnatBinaryRequest request;
+    memset(&request, 0, sizeof(request));
+    request.version = SLNAT_BINARY_VERSION;
+    request.command = command;
+    request.id = htonl(id);
+    memcpy(request.addr, addr.s6_addr, sizeof(request.addr));
+    return request;
+}
+
+inline void slnat_set_binary_interface(SlnatBinaryResponse& response, const std::string& interface) {
+    memset(response.interface, 0, sizeof(response.interface));
+    memcpy(response.interface, interface.data(), std::min(interface.size(), sizeof(response.interface)));
+}
+
+inline std::string slnat_binary_interface(const SlnatBinaryResponse& response) {
+    return std::string(response.interface, strnlen(response.interface, sizeof(response.interface)));
+}
+
+inline uint64_t slnat_binary_generation(const SlnatBinaryResponse& response) {
+    return be64toh(response.generation);
+}
+
+// The instance id is drawn at random when the daemon starts, so a client
+// can tell a restarted daemon apart even if it reuses a generation. JSON
+// replies carry it as 16 hex digits.
+inline std::string slnat_format_instance(uint64_t instance) {
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(instance));
+    return text;
+}
+
+inline void slnat_set_binary_instance(SlnatBinaryResponse& response, uint64_t instance) {
+    uint64_t value = htobe64(instance);
+    memcpy(response.addr, &value, sizeof(value));
+}
+
+inline std::string slnat_binary_instance(const SlnatBinaryResponse& response) {
+    uint64_t value;
+    memcpy(&value, response.addr, sizeof(value));
+    return slnat_format_instance(be64toh(value));
+}
+
+#endif // SLNAT_BINARY_H
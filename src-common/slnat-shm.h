@@ -0,0 +1,318 @@
+// SlickNat shared-memory mapping table
+//
+// With "shm_export" configured, the daemon publishes every mapping table
+// generation as a read-only file (default /run/slnatcd/mappings) holding
+// the mappings and both longest-prefix-match tries. Colocated programs map
+// the file and look addresses up without talking to the daemon.
+//
+// A published file is never modified except for its superseded flag: each
+// generation is written to a temporary file and renamed into place, then
+// the previous file is flagged. Readers therefore always see a complete
+// table and reopen the path once their mapping is flagged, without any
+// system call on the lookup path. Integers are in host byte order.
+//
+// The daemon's "snapshot" file, which it reloads at startup, uses the
+// same layout.
+
+#ifndef SLNAT_SHM_H
+#define SLNAT_SHM_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+#define SLNAT_SHM_MAGIC "SLNATSHM"
+#define SLNAT_SHM_VERSION 1
+#define SLNAT_SHM_DEFAULT_PATH "/run/slnatcd/mappings"
+
+struct SlnatShmHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t generation;
+    uint32_t superseded;            // Set once a newer file replaced this one
+    uint32_t mapping_count;
+    uint32_t internal_node_count;
+    uint32_t external_node_count;
+    uint64_t mappings_offset;       // SlnatShmMapping[mapping_count]
+    uint64_t internal_nodes_offset; // SlnatShmNode[internal_node_count]
+    uint64_t external_nodes_offset; // SlnatShmNode[external_node_count]
+    uint64_t internal_values_offset;// int32_t[mapping_count], next value per prefix
+    uint64_t external_values_offset;// int32_t[mapping_count]
+    uint64_t file_size;
+};
+
+// Trie node; node 0 is the root. Children branch on the first bit past
+// prefix_len, and value_head starts the chain of mapping indexes stored
+// under this exact prefix (-1 when none).
+struct SlnatShmNode {
+    uint8_t key[16];
+    int32_t prefix_len;
+    int32_t child[2];
+    int32_t value_head;
+};
+
+struct SlnatShmMapping {
+    uint8_t internal_addr[16];
+    uint8_t external_addr[16];
+    int32_t prefix_len;
+    char interface[16];             // NUL-padded interface name
+    uint8_t reserved[12];
+};
+
+static_assert(sizeof(SlnatShmHeader) == 88, "shm header must be 88 bytes");
+static_assert(sizeof(SlnatShmNode) == 32, "shm node must be 32 bytes");
+static_assert(sizeof(SlnatShmMapping) == 64, "shm mapping must be 64 bytes");
+
+struct SlnatShmResult {
+    struct in6_addr mapped;
+    std::string interface;
+    bool external_match;            // resolve matched an external prefix
+    uint64_t generation;
+};
+
+// Maps the exported table and answers resolve/get2kip lookups the same way
+// the daemon does. Not thread-safe; use one reader per thread.
+class SlnatShmReader {
+public:
+    explicit SlnatShmReader(const std::string& file_path = SLNAT_SHM_DEFAULT_PATH)
+        : path(file_path), base(nullptr), size(0) {}
+    
+    ~SlnatShmReader() {
+        unmap();
+    }
+    
+    SlnatShmReader(const SlnatShmReader&) = delete;
+    SlnatShmReader& operator=(const SlnatShmReader&) = delete;
+    
+    // Maps the current file if nothing is mapped or the mapping was
+    // superseded. Returns false when no valid table is available.
+    bool available() {
+        if (base && !__atomic_load_n(&header()->superseded, __ATOMIC_ACQUIRE)) {
+            return true;
+        }
+        unmap();
+        return map_current();
+    }
+    
+    uint64_t generation() {
+        return available() ? header()->generation : 0;
+    }
+    
+    // The whole mapping array, for readers that rebuild their own table
+    // from the file; nullptr when no valid table is available
+    const SlnatShmMapping* mapping_list(uint32_t& count) {
+        if (!available()) {
+            count = 0;
+            return nullptr;
+        }
+        count = header()->mapping_count;
+        return mappings();
+    }
+    
+    // Longest internal match first, then longest external match
+    bool resolve(const struct in6_addr& addr, SlnatShmResult& result) {
+        if (!available()) {
+            return false;
+        }
+        
+        const SlnatShmHeader* h = header();
+        int32_t index = -1;
+        bool external = false;
+        visit_matches(h->internal_nodes_offset, h->internal_node_count, h->internal_values_offset, addr,
+                      [&index](int32_t value) {
+            index = value;
+            return true;
+        });
+        if (index == -1) {
+            external = true;
+            visit_matches(h->external_nodes_offset, h->external_node_count, h->external_values_offset, addr,
+                          [&index](int32_t value) {
+                index = value;
+                return true;
+            });
+        }
+        if (index == -1) {
+            return false;
+        }
+        
+        const SlnatShmMapping& mapping = mappings()[index];
+        result.mapped = addr;
+        remap(result.mapped, external ? mapping.internal_addr : mapping.external_addr, mapping.prefix_len);
+        fill_result(mapping, result);
+        result.external_match = external;
+        return true;
+    }
+    
+    // Longest matching internal prefix whose mapped address is 2000::/3
+    bool get2kip(const struct in6_addr& addr, SlnatShmResult& result) {
+        if (!available()) {
+            return false;
+        }
+        
+        const SlnatShmHeader* h = header();
+        return visit_matches(h->internal_nodes_offset, h->internal_node_count, h->internal_values_offset, addr,
+                             [&](int32_t value) {
+            const SlnatShmMapping& mapping = mappings()[value];
+            struct in6_addr global_addr = addr;
+            remap(global_addr, mapping.external_addr, mapping.prefix_len);
+            if ((global_addr.s6_addr[0] & 0xE0) != 0x20) {
+                return false;
+            }
+            result.mapped = global_addr;
+            fill_result(mapping, result);
+            result.external_match = false;
+            return true;
+        });
+    }
+    
+private:
+    std::string path;
+    void* base;
+    size_t size;
+    
+    const SlnatShmHeader* header() const {
+        return static_cast<const SlnatShmHeader*>(base);
+    }
+    
+    const SlnatShmMapping* mappings() const {
+        return reinterpret_cast<const SlnatShmMapping*>(static_cast<const char*>(base) + header()->mappings_offset);
+    }
+    
+    void unmap() {
+        if (base) {
+            munmap(base, size);
+            base = nullptr;
+            size = 0;
+        }
+    }
+    
+    bool map_current() {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+        
+        struct stat st;
+        if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(SlnatShmHeader)) {
+            close(fd);
+            return false;
+        }
+        
+        void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        
+        base = mapped;
+        size = st.st_size;
+        if (!valid()) {
+            unmap();
+            return false;
+        }
+        return true;
+    }
+    
+    bool section_fits(uint64_t offset, uint64_t count, size_t element_size) const {
+        return offset % 8 == 0 && offset <= size && count <= (size - offset) / element_size;
+    }
+    
+    bool valid() const {
+        const SlnatShmHeader* h = header();
+        return memcmp(h->magic, SLNAT_SHM_MAGIC, sizeof(h->magic)) == 0 &&
+               h->version == SLNAT_SHM_VERSION &&
+               h->header_size == sizeof(SlnatShmHeader) &&
+               h->file_size == size &&
+               h->internal_node_count > 0 && h->external_node_count > 0 &&
+               section_fits(h->mappings_offset, h->mapping_count, sizeof(SlnatShmMapping)) &&
+               section_fits(h->internal_nodes_offset, h->internal_node_count, sizeof(SlnatShmNode)) &&
+               section_fits(h->external_nodes_offset, h->external_node_count, sizeof(SlnatShmNode)) &&
+               section_fits(h->internal_values_offset, h->mapping_count, sizeof(int32_t)) &&
+               section_fits(h->external_values_offset, h->mapping_count, sizeof(int32_t));
+    }
+    
+    void fill_result(const SlnatShmMapping& mapping, SlnatShmResult& result) const {
+        result.interface.assign(mapping.interface, strnlen(mapping.interface, sizeof(mapping.interface)));
+        result.generation = header()->generation;
+    }
+    
+    static bool prefix_equal(const uint8_t* a, const uint8_t* b, int prefix_len) {
+        int bytes = prefix_len / 8;
+        int bits = prefix_len % 8;
+        if (memcmp(a, b, bytes) != 0) {
+            return false;
+        }
+        if (bits > 0 && bytes < 16) {
+            uint8_t mask = (0xFF << (8 - bits)) & 0xFF;
+            return (a[bytes] & mask) == (b[bytes] & mask);
+        }
+        return true;
+    }
+    
+    static void remap(struct in6_addr& addr, const uint8_t* prefix, int prefix_len) {
+        int bytes = prefix_len / 8;
+        int bits = prefix_len % 8;
+        memcpy(addr.s6_addr, prefix, bytes);
+        if (bits > 0 && bytes < 16) {
+            uint8_t mask = (0xFF << (8 - bits)) & 0xFF;
+            addr.s6_addr[bytes] = (prefix[bytes] & mask) | (addr.s6_addr[bytes] & ~mask);
+        }
+    }
+    
+    // Same walk as the daemon's PrefixTrie::visit_matches, with every index
+    // bounds-checked so a damaged file cannot send a reader out of the map
+    template <typename Visitor>
+    bool visit_matches(uint64_t nodes_offset, uint32_t node_count, uint64_t values_offset,
+                       const struct in6_addr& addr, Visitor visit) const {
+        const char* data = static_cast<const char*>(base);
+        const SlnatShmNode* nodes = reinterpret_cast<const SlnatShmNode*>(data + nodes_offset);
+        const int32_t* value_next = reinterpret_cast<const int32_t*>(data + values_offset);
+        uint32_t mapping_count = header()->mapping_count;
+        
+        int32_t path_nodes[129];
+        int depth = 0;
+        int32_t cur = 0;
+        
+        while (depth < 129) {
+            const SlnatShmNode& node = nodes[cur];
+            if (node.prefix_len < 0 || node.prefix_len > 128) {
+                return false;
+            }
+            if (node.value_head != -1) {
+                path_nodes[depth++] = cur;
+            }
+            if (node.prefix_len == 128) {
+                break;
+            }
+            
+            int bit = (addr.s6_addr[node.prefix_len / 8] >> (7 - node.prefix_len % 8)) & 1;
+            int32_t child = node.child[bit];
+            if (child < 0 || static_cast<uint32_t>(child) >= node_count ||
+                nodes[child].prefix_len <= node.prefix_len || nodes[child].prefix_len > 128 ||
+                !prefix_equal(addr.s6_addr, nodes[child].key, nodes[child].prefix_len)) {
+                break;
+            }
+            cur = child;
+        }
+        
+        while (depth > 0) {
+            int32_t value = nodes[path_nodes[--depth]].value_head;
+            for (uint32_t steps = 0; value >= 0 && static_cast<uint32_t>(value) < mapping_count && steps < mapping_count;
+                 steps++) {
+                if (visit(value)) {
+                    return true;
+                }
+                value = value_next[value];
+            }
+        }
+        return false;
+    }
+};
+
+#endif // SLNAT_SHM_H
@@ -0,0 +1,1168 @@
+// SlickNat client library, C++ implementation
+
+#include "slnat-client.h"
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+int SlickNatClient::connect_to_daemon(json& error, int type) {
+    int client_socket = socket(unix_path.empty() ? AF_INET6 : AF_UNIX, type, 0);
+    if (client_socket == -1) {
+        error = make_error(SlnatClientError::CONNECT, "Failed to create socket");
+        return -1;
+    }
+    
+    if (type != SOCK_DGRAM && io_timeout_ms > 0) {
+        struct timeval timeout;
+        timeout.tv_sec = io_timeout_ms / 1000;
+        timeout.tv_usec = (io_timeout_ms % 1000) * 1000;
+        setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+    
+    if (!unix_path.empty()) {
+        struct sockaddr_un server_addr;
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sun_family = AF_UNIX;
+        strncpy(server_addr.sun_path, unix_path.c_str(), sizeof(server_addr.sun_path) - 1);
+        
+        if (connect(client_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+            close(client_socket);
+            error = make_error(SlnatClientError::CONNECT, "Cannot connect to daemon at " + daemon_name());
+            return -1;
+        }
+        return client_socket;
+    }
+    
+    struct sockaddr_in6 server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin6_family = AF_INET6;
+    server_addr.sin6_port = htons(server_port);
+    
+    if (inet_pton(AF_INET6, server_address.c_str(), &server_addr.sin6_addr) != 1) {
+        close(client_socket);
+        error = make_error(SlnatClientError::INVALID, "Invalid server IPv6 address");
+        return -1;
+    }
+    
+    if (connect(client_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+        close(client_socket);
+        error = make_error(SlnatClientError::CONNECT, "Cannot connect to daemon at " + daemon_name());
+        return -1;
+    }
+    
+    return client_socket;
+}
+
+bool SlickNatClient::send_all(int client_socket, const std::string& data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t sent = send(client_socket, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        offset += sent;
+    }
+    return true;
+}
+
+bool SlickNatClient::send_pipeline(const std::string& data) {
+    char buffer[65536];
+    size_t offset = 0;
+    while (offset < data.size()) {
+        struct pollfd pfd;
+        pfd.fd = persistent_socket;
+        pfd.events = POLLIN | POLLOUT;
+        pfd.revents = 0;
+        int ready = poll(&pfd, 1, io_timeout_ms > 0 ? io_timeout_ms : -1);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (ready == 0) {
+            errno = EAGAIN;
+            return false;
+        }
+        
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t bytes_received = recv(persistent_socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (bytes_received == 0) {
+                errno = ECONNRESET;
+                return false;
+            }
+            if (bytes_received > 0) {
+                recv_buffer.append(buffer, bytes_received);
+            } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+        }
+        if (pfd.revents & POLLOUT) {
+            ssize_t sent = send(persistent_socket, data.data() + offset, data.size() - offset,
+                                MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (sent > 0) {
+                offset += sent;
+            } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool SlickNatClient::fill_recv_buffer() {
+    char buffer[4096];
+    while (true) {
+        ssize_t bytes_received = recv(persistent_socket, buffer, sizeof(buffer), 0);
+        if (bytes_received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_received == 0) {
+            // Closed by the daemon rather than timed out
+            errno = ECONNRESET;
+        }
+        if (bytes_received <= 0) {
+            return false;
+        }
+        recv_buffer.append(buffer, bytes_received);
+        return true;
+    }
+}
+
+bool SlickNatClient::read_line(std::string& line) {
+    size_t newline;
+    while ((newline = recv_buffer.find('\n')) == std::string::npos) {
+        if (!fill_recv_buffer()) {
+            return false;
+        }
+    }
+    
+    line = recv_buffer.substr(0, newline);
+    recv_buffer.erase(0, newline + 1);
+    return true;
+}
+
+json SlickNatClient::receive_error() {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return make_error(SlnatClientError::TIMEOUT, "Timed out waiting for daemon");
+    }
+    return make_error(SlnatClientError::IO, "Failed to receive response");
+}
+
+std::vector<json> SlickNatClient::send_binary(uint8_t command, const std::vector<std::string>& ips) {
+    std::vector<json> responses(ips.size());
+    std::vector<size_t> sent_index;
+    std::string batch;
+    
+    for (size_t i = 0; i < ips.size(); i++) {
+        struct in6_addr addr;
+        if (inet_pton(AF_INET6, ips[i].c_str(), &addr) != 1) {
+            responses[i] = make_error(SlnatClientError::INVALID, "Invalid IPv6 address format");
+            continue;
+        }
+        SlnatBinaryRequest request = slnat_make_binary_request(command, static_cast<uint32_t>(i), addr);
+        batch.append(reinterpret_cast<const char*>(&request), sizeof(request));
+        sent_index.push_back(i);
+    }
+    
+    if (sent_index.empty()) {
+        return responses;
+    }
+    
+    // Collect one response record per sent request, in order
+    std::string records;
+    json error;
+    
+    if (udp || seqpacket) {
+        size_t chunk = MAX_MESSAGE_RECORDS * sizeof(SlnatBinaryRequest);
+        for (size_t offset = 0; offset < batch.size(); offset += chunk) {
+            std::string reply;
+            bool ok = udp ? udp_exchange(batch.substr(offset, chunk), reply, error)
+                          : message_exchange(batch.substr(offset, chunk), reply, error);
+            if (!ok) {
+                break;
+            }
+            records += reply;
+        }
+    } else if (ensure_connected(error)) {
+        if (send_pipeline(batch)) {
+            size_t expected = sent_index.size() * sizeof(SlnatBinaryResponse);
+            while (recv_buffer.size() < expected && fill_recv_buffer()) {
+            }
+            if (recv_buffer.size() < expected) {
+                error = receive_error();
+            }
+            size_t available = std::min(expected, recv_buffer.size());
+            records = recv_buffer.substr(0, available);
+            recv_buffer.erase(0, available);
+        } else {
+            error = errno == EAGAIN ? receive_error() : make_error(SlnatClientError::IO, "Failed to send request");
+        }
+        if (!error.is_null()) {
+            disconnect();
+        }
+    }
+    
+    for (size_t n = 0; n < sent_index.size(); n++) {
+        size_t i = sent_index[n];
+        SlnatBinaryResponse response;
+        if ((n + 1) * sizeof(response) > records.size()) {
+            responses[i] = error.is_null() ? make_error(SlnatClientError::IO, "Failed to receive response") : error;
+            continue;
+        }
+        memcpy(&response, records.data() + n * sizeof(response), sizeof(response));
+        if (ntohl(response.id) != i) {
+            responses[i] = make_error(SlnatClientError::PROTOCOL, "Mismatched response id");
+            continue;
+        }
+        responses[i] = binary_to_json(command, ips[i], response);
+    }
+    
+    return responses;
+}
+
+bool SlickNatClient::udp_exchange(const std::string& payload, std::string& reply, json& error) {
+    int client_socket = connect_to_daemon(error, SOCK_DGRAM);
+    if (client_socket == -1) {
+        return false;
+    }
+    
+    std::vector<char> buffer(65536);
+    for (int attempt = 0; attempt <= udp_retries; attempt++) {
+        if (send(client_socket, payload.data(), payload.size(), 0) == -1) {
+            close(client_socket);
+            error = make_error(SlnatClientError::IO, "Failed to send request");
+            return false;
+        }
+        
+        struct pollfd pfd = {client_socket, POLLIN, 0};
+        int ready = poll(&pfd, 1, udp_timeout_ms);
+        if (ready == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        
+        ssize_t bytes_received = recv(client_socket, buffer.data(), buffer.size(), 0);
+        if (bytes_received > 0) {
+            reply.assign(buffer.data(), bytes_received);
+            close(client_socket);
+            return true;
+        }
+    }
+    
+    close(client_socket);
+    error = make_error(SlnatClientError::TIMEOUT, "No reply from daemon at " + daemon_name() + " after " +
+                       std::to_string(udp_retries + 1) + " attempts");
+    return false;
+}
+
+bool SlickNatClient::message_exchange(const std::string& payload, std::string& reply, json& error) {
+    if (!ensure_connected(error)) {
+        return false;
+    }
+    
+    ssize_t sent;
+    do {
+        sent = send(persistent_socket, payload.data(), payload.size(), MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+    if (sent == -1) {
+        disconnect();
+        error = make_error(SlnatClientError::IO, "Failed to send request");
+        return false;
+    }
+    
+    ssize_t length;
+    do {
+        length = recv(persistent_socket, nullptr, 0, MSG_PEEK | MSG_TRUNC);
+    } while (length == -1 && errno == EINTR);
+    if (length > 0) {
+        reply.resize(length);
+        do {
+            length = recv(persistent_socket, &reply[0], reply.size(), 0);
+        } while (length == -1 && errno == EINTR);
+    }
+    if (length <= 0) {
+        error = length == 0 ? make_error(SlnatClientError::IO, "Failed to receive response") : receive_error();
+        disconnect();
+        return false;
+    }
+    return true;
+}
+
+json SlickNatClient::binary_to_json(uint8_t command, const std::string& ip, const SlnatBinaryResponse& response) {
+    uint64_t generation = slnat_binary_generation(response);
+    
+    if (response.status == SLNAT_STATUS_BAD_REQUEST) {
+        return make_error(SlnatClientError::PROTOCOL, "Daemon rejected binary request");
+    }
+    if (response.status == SLNAT_STATUS_BUSY) {
+        return {{"error", "Daemon is busy"}, {"status", "busy"}};
+    }
+    
+    json result;
+    if (command == SLNAT_CMD_PING) {
+        result = {{"status", "pong"}, {"generation", generation}, {"instance", slnat_binary_instance(response)}};
+    } else if (response.status != SLNAT_STATUS_SUCCESS) {
+        result = {{"ip", ip}, {"generation", generation}, {"status", "not_found"}};
+    } else {
+        result = {
+            {"interface", slnat_binary_interface(response)},
+            {"generation", generation},
+            {"status", "success"}
+        };
+        add_mapped_address(command, ip, response, result);
+    }
+    if (response.flags & SLNAT_FLAG_STALE) {
+        result["stale"] = true;
+    }
+    return result;
+}
+
+void SlickNatClient::add_mapped_address(uint8_t command, const std::string& ip, const SlnatBinaryResponse& response,
+                                        json& result) {
+    struct in6_addr mapped;
+    memcpy(mapped.s6_addr, response.addr, sizeof(mapped.s6_addr));
+    char mapped_str[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, &mapped, mapped_str, sizeof(mapped_str));
+    
+    if (command == SLNAT_CMD_GET2KIP) {
+        result["internal_ip"] = ip;
+        result["global_ip"] = mapped_str;
+    } else if (response.flags & SLNAT_FLAG_EXTERNAL_MATCH) {
+        result["external_ip"] = ip;
+        result["internal_ip"] = mapped_str;
+    } else {
+        result["internal_ip"] = ip;
+        result["public_ip"] = mapped_str;
+    }
+}
+
+bool SlickNatClient::ensure_connected(json& error) {
+    if (persistent_socket == -1) {
+        persistent_socket = connect_to_daemon(error, seqpacket ? SOCK_SEQPACKET : SOCK_STREAM);
+        recv_buffer.clear();
+    }
+    return persistent_socket != -1;
+}
+
+std::vector<json> SlickNatClient::send_batch(const std::string& command, const std::vector<std::string>& ips) {
+    // Split large batches so each request stays under the daemon's size
+    // limit and, over udp and seqpacket, each reply fits in one message
+    size_t limit = udp || seqpacket ? MAX_DATAGRAM_BATCH : MAX_STREAM_BATCH;
+    if (ips.size() > limit) {
+        std::vector<json> responses;
+        for (size_t offset = 0; offset < ips.size(); offset += limit) {
+            size_t end = std::min(ips.size(), offset + limit);
+            std::vector<json> part = send_batch(command, std::vector<std::string>(ips.begin() + offset,
+                                                                                  ips.begin() + end));
+            responses.insert(responses.end(), part.begin(), part.end());
+        }
+        return responses;
+    }
+    
+    json request = {
+        {"command", command},
+        {"ips", ips}
+    };
+    json response = send_request(request);
+    
+    auto results = response.find("results");
+    if (results == response.end() || !results->is_array() || results->size() != ips.size()) {
+        if (!response.contains("error")) {
+            response = make_error(SlnatClientError::PROTOCOL, "Malformed batch response");
+        }
+        return std::vector<json>(ips.size(), response);
+    }
+    
+    // Results share the batch's generation and stale mark; copy them so
+    // each one can be handled like a single response
+    std::vector<json> responses = results->get<std::vector<json>>();
+    bool stale = response.value("stale", false);
+    if (response.contains("generation")) {
+        for (auto& result : responses) {
+            result["generation"] = response["generation"];
+            if (stale) {
+                result["stale"] = true;
+            }
+        }
+    }
+    return responses;
+}
+
+int64_t SlickNatClient::now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void SlickNatClient::load_cache() {
+    cache = {{"instance", ""}, {"generation", -1}, {"checked_ms", 0}, {"entries", json::object()}};
+    
+    std::ifstream file(cache_path);
+    if (!file.is_open()) {
+        return;
+    }
+    try {
+        json loaded = json::parse(file);
+        if (loaded.value("daemon", "") == server_address && loaded.value("port", 0) == server_port &&
+            loaded.contains("entries") && loaded["entries"].is_object()) {
+            cache = loaded;
+        }
+    } catch (const std::exception&) {
+    }
+}
+
+void SlickNatClient::save_cache() {
+    cache["daemon"] = server_address;
+    cache["port"] = server_port;
+    
+    std::string temp_path = cache_path + "." + std::to_string(getpid());
+    {
+        std::ofstream file(temp_path);
+        if (!file.is_open()) {
+            return;
+        }
+        file << cache.dump();
+    }
+    if (rename(temp_path.c_str(), cache_path.c_str()) == -1) {
+        unlink(temp_path.c_str());
+    }
+}
+
+bool SlickNatClient::revalidate_cache() {
+    int64_t now = now_ms();
+    if (now - cache.value("checked_ms", int64_t(0)) < cache_ttl_ms) {
+        return true;
+    }
+    
+    json pong = ping();
+    if (!pong.contains("generation")) {
+        return false;
+    }
+    
+    // A restarted daemon may number its tables like the previous process,
+    // so the entries are only kept for the same instance and generation
+    int64_t generation = pong["generation"].get<int64_t>();
+    std::string instance = pong.value("instance", "");
+    if (generation != cache.value("generation", int64_t(-1)) || instance != cache.value("instance", "")) {
+        cache["instance"] = instance;
+        cache["generation"] = generation;
+        cache["entries"] = json::object();
+    }
+    cache["checked_ms"] = now;
+    return true;
+}
+
+std::vector<json> SlickNatClient::cached_lookup(const std::string& command, const std::vector<std::string>& ips,
+                                               const std::function<std::vector<json>(const std::vector<std::string>&)>& fetch) {
+    if (cache_ttl_ms <= 0 || cache_path.empty()) {
+        return fetch(ips);
+    }
+    
+    load_cache();
+    int64_t checked_before = cache.value("checked_ms", int64_t(0));
+    if (!revalidate_cache()) {
+        return fetch(ips);
+    }
+    
+    std::vector<json> responses(ips.size());
+    std::vector<std::string> missing;
+    std::vector<size_t> missing_index;
+    json& entries = cache["entries"];
+    
+    for (size_t i = 0; i < ips.size(); i++) {
+        auto entry = entries.find(command + " " + ips[i]);
+        if (entry != entries.end()) {
+            responses[i] = *entry;
+        } else {
+            missing.push_back(ips[i]);
+            missing_index.push_back(i);
+        }
+    }
+    
+    bool modified = cache.value("checked_ms", int64_t(0)) != checked_before;
+    if (!missing.empty()) {
+        std::vector<json> fetched = fetch(missing);
+        int64_t generation = cache.value("generation", int64_t(-1));
+        
+        for (size_t n = 0; n < missing.size(); n++) {
+            const json& response = fetched[n];
+            responses[missing_index[n]] = response;
+            
+            // Errors are never cached, nor answers from a newer table
+            if (response.contains("error") && response.value("status", "") != "not_found") {
+                continue;
+            }
+            if (response.value("generation", int64_t(-1)) != generation) {
+                continue;
+            }
+            if (entries.size() >= MAX_CACHE_ENTRIES) {
+                entries.erase(entries.begin());
+            }
+            entries[command + " " + missing[n]] = response;
+            modified = true;
+        }
+    }
+    
+    if (modified) {
+        save_cache();
+    }
+    return responses;
+}
+
+std::vector<json> SlickNatClient::shm_lookup(bool global_only, const std::vector<std::string>& ips) {
+    std::vector<json> responses;
+    for (const auto& ip : ips) {
+        struct in6_addr addr;
+        if (inet_pton(AF_INET6, ip.c_str(), &addr) != 1) {
+            responses.push_back(make_error(SlnatClientError::INVALID, "Invalid IPv6 address format"));
+            continue;
+        }
+        if (!shm->available()) {
+            responses.push_back(make_error(SlnatClientError::CONNECT, "No mapping table exported at " + shm_path));
+            continue;
+        }
+        
+        SlnatShmResult result;
+        bool found = global_only ? shm->get2kip(addr, result) : shm->resolve(addr, result);
+        if (!found) {
+            responses.push_back({{"ip", ip}, {"generation", shm->generation()}, {"status", "not_found"}});
+            continue;
+        }
+        
+        char mapped_str[INET6_ADDRSTRLEN];
+        inet_ntop(AF_INET6, &result.mapped, mapped_str, sizeof(mapped_str));
+        json response = {
+            {"interface", result.interface},
+            {"generation", result.generation},
+            {"status", "success"}
+        };
+        if (global_only) {
+            response["internal_ip"] = ip;
+            response["global_ip"] = mapped_str;
+        } else if (result.external_match) {
+            response["external_ip"] = ip;
+            response["internal_ip"] = mapped_str;
+        } else {
+            response["internal_ip"] = ip;
+            response["public_ip"] = mapped_str;
+        }
+        responses.push_back(response);
+    }
+    return responses;
+}
+
+json SlickNatClient::parse_response(const std::string& data) {
+    try {
+        return json::parse(data);
+    } catch (const std::exception& e) {
+        return make_error(SlnatClientError::PROTOCOL, std::string("Failed to parse response: ") + e.what());
+    }
+}
+
+SlickNatClient::SlickNatClient(const std::string& addr, int port)
+    : server_address(addr), server_port(port), seqpacket(false), persistent(false), binary(false),
+      persistent_socket(-1), io_timeout_ms(0), udp(false), udp_timeout_ms(1000), udp_retries(2), cache_ttl_ms(0) {
+    if (addr.compare(0, 5, "unix:") == 0) {
+        unix_path = addr.substr(5);
+    }
+}
+
+SlickNatClient::~SlickNatClient() {
+    disconnect();
+}
+
+std::string SlickNatClient::daemon_name() const {
+    if (!unix_path.empty()) {
+        return server_address;
+    }
+    return "[" + server_address + "]:" + std::to_string(server_port);
+}
+
+void SlickNatClient::set_persistent(bool enable) {
+    if (!enable) {
+        disconnect();
+    }
+    persistent = enable;
+}
+
+void SlickNatClient::set_binary(bool enable) {
+    if (enable != binary) {
+        disconnect();
+    }
+    binary = enable;
+}
+
+void SlickNatClient::set_seqpacket(bool enable) {
+    disconnect();
+    seqpacket = enable;
+}
+
+void SlickNatClient::set_udp(bool enable, int timeout_ms, int retries) {
+    disconnect();
+    udp = enable;
+    udp_timeout_ms = timeout_ms;
+    udp_retries = retries;
+}
+
+void SlickNatClient::set_cache(int ttl_ms) {
+    cache_ttl_ms = ttl_ms;
+    cache_path.clear();
+    if (ttl_ms <= 0) {
+        return;
+    }
+    
+    std::string dir;
+    if (geteuid() == 0) {
+        dir = "/run/slnatc";
+    } else if (const char* runtime_dir = getenv("XDG_RUNTIME_DIR")) {
+        dir = std::string(runtime_dir) + "/slnatc";
+    } else {
+        return;
+    }
+    
+    if (mkdir(dir.c_str(), 0700) == -1 && errno != EEXIST) {
+        return;
+    }
+    std::string name = server_address;
+    std::replace(name.begin(), name.end(), '/', '_');
+    cache_path = dir + "/" + name + "_" + std::to_string(server_port) + ".json";
+}
+
+void SlickNatClient::set_shm(const std::string& path) {
+    shm_path = path;
+    shm.reset(path.empty() ? nullptr : new SlnatShmReader(path));
+}
+
+void SlickNatClient::set_timeout(int timeout_ms) {
+    disconnect();
+    io_timeout_ms = timeout_ms;
+}
+
+bool SlickNatClient::connected() const {
+    return persistent_socket != -1;
+}
+
+void SlickNatClient::disconnect() {
+    if (persistent_socket != -1) {
+        close(persistent_socket);
+        persistent_socket = -1;
+    }
+    recv_buffer.clear();
+}
+
+json SlickNatClient::send_request(const json& request) {
+    if (udp || seqpacket) {
+        std::string reply;
+        json error;
+        bool ok = udp ? udp_exchange(request.dump(), reply, error) : message_exchange(request.dump(), reply, error);
+        if (!ok) {
+            return error;
+        }
+        return parse_response(reply);
+    }
+    if (persistent) {
+        return send_pipelined({request}).front();
+    }
+    
+    json error;
+    int client_socket = connect_to_daemon(error);
+    if (client_socket == -1) {
+        return error;
+    }
+    
+    // Send request
+    if (!send_all(client_socket, request.dump())) {
+        close(client_socket);
+        return make_error(SlnatClientError::IO, "Failed to send request");
+    }
+    
+    // Receive response; the daemon closes the connection once it is sent
+    std::string response_str;
+    json error_response = make_error(SlnatClientError::IO, "Failed to receive response");
+    char buffer[4096];
+    while (true) {
+        ssize_t bytes_received = recv(client_socket, buffer, sizeof(buffer), 0);
+        if (bytes_received == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytes_received == -1) {
+            error_response = receive_error();
+        }
+        if (bytes_received <= 0) {
+            break;
+        }
+        response_str.append(buffer, bytes_received);
+    }
+    close(client_socket);
+    
+    if (response_str.empty()) {
+        return error_response;
+    }
+    
+    return parse_response(response_str);
+}
+
+std::vector<json> SlickNatClient::send_pipelined(const std::vector<json>& requests) {
+    std::vector<json> responses;
+    
+    if (!persistent) {
+        for (const auto& request : requests) {
+            responses.push_back(send_request(request));
+        }
+        return responses;
+    }
+    
+    json error;
+    if (!ensure_connected(error)) {
+        return std::vector<json>(requests.size(), error);
+    }
+    
+    std::string batch;
+    for (const auto& request : requests) {
+        batch += request.dump();
+        batch += '\n';
+    }
+    
+    if (!send_pipeline(batch)) {
+        json send_error = errno == EAGAIN ? receive_error()
+                                          : make_error(SlnatClientError::IO, "Failed to send request");
+        disconnect();
+        return std::vector<json>(requests.size(), send_error);
+    }
+    
+    // Most answers may already be buffered, so lines are consumed by
+    // position and the buffer is trimmed once at the end
+    size_t position = 0;
+    for (size_t i = 0; i < requests.size(); i++) {
+        size_t newline;
+        while ((newline = recv_buffer.find('\n', position)) == std::string::npos) {
+            if (!fill_recv_buffer()) {
+                break;
+            }
+        }
+        if (newline == std::string::npos) {
+            responses.resize(requests.size(), receive_error());
+            disconnect();
+            return responses;
+        }
+        responses.push_back(parse_response(recv_buffer.substr(position, newline - position)));
+        position = newline + 1;
+    }
+    recv_buffer.erase(0, position);
+    
+    return responses;
+}
+
+json SlickNatClient::resolve_ip(const std::string& ip) {
+    if (binary) {
+        return send_binary(SLNAT_CMD_RESOLVE, {ip}).front();
+    }
+    return send_request(make_resolve_request(ip));
+}
+
+json SlickNatClient::get_global_ip(const std::string& ip) {
+    if (binary) {
+        return send_binary(SLNAT_CMD_GET2KIP, {ip}).front();
+    }
+    return send_request(make_get_global_request(ip));
+}
+
+std::vector<json> SlickNatClient::resolve_batch(const std::vector<std::string>& ips) {
+    if (binary) {
+        return send_binary(SLNAT_CMD_RESOLVE, ips);
+    }
+    return send_batch("resolve_batch", ips);
+}
+
+std::vector<json> SlickNatClient::get_global_batch(const std::vector<std::string>& ips) {
+    if (binary) {
+        return send_binary(SLNAT_CMD_GET2KIP, ips);
+    }
+    return send_batch("get2kip_batch", ips);
+}
+
+std::vector<json> SlickNatClient::resolve_ips(const std::vector<std::string>& ips) {
+    return cached_lookup("resolve", ips, [this](const std::vector<std::string>& missing) {
+        return query_resolve_ips(missing);
+    });
+}
+
+std::vector<json> SlickNatClient::get_global_ips(const std::vector<std::string>& ips) {
+    return cached_lookup("get2kip", ips, [this](const std::vector<std::string>& missing) {
+        return query_global_ips(missing);
+    });
+}
+
+std::vector<json> SlickNatClient::query_resolve_ips(const std::vector<std::string>& ips) {
+    std::vector<json> responses;
+    auto query_valid = [this](const std::vector<std::string>& valid) { return query_resolve_ips(valid); };
+    if (answer_invalid(ips, responses, query_valid)) {
+        return responses;
+    }
+    if (shm) {
+        return shm_lookup(false, ips);
+    }
+    if (persistent && !binary && !udp) {
+        std::vector<json> requests;
+        for (const auto& ip : ips) {
+            requests.push_back(make_resolve_request(ip));
+        }
+        return send_pipelined(requests);
+    }
+    if (ips.size() == 1) {
+        return {resolve_ip(ips.front())};
+    }
+    return resolve_batch(ips);
+}
+
+std::vector<json> SlickNatClient::query_global_ips(const std::vector<std::string>& ips) {
+    std::vector<json> responses;
+    auto query_valid = [this](const std::vector<std::string>& valid) { return query_global_ips(valid); };
+    if (answer_invalid(ips, responses, query_valid)) {
+        return responses;
+    }
+    if (shm) {
+        return shm_lookup(true, ips);
+    }
+    if (persistent && !binary && !udp) {
+        std::vector<json> requests;
+        for (const auto& ip : ips) {
+            requests.push_back(make_get_global_request(ip));
+        }
+        return send_pipelined(requests);
+    }
+    if (ips.size() == 1) {
+        return {get_global_ip(ips.front())};
+    }
+    return get_global_batch(ips);
+}
+
+bool SlickNatClient::answer_invalid(const std::vector<std::string>& ips, std::vector<json>& responses,
+                                    const std::function<std::vector<json>(const std::vector<std::string>&)>& fetch) {
+    std::vector<std::string> valid;
+    std::vector<size_t> valid_index;
+    for (size_t i = 0; i < ips.size(); i++) {
+        struct in6_addr addr;
+        if (inet_pton(AF_INET6, ips[i].c_str(), &addr) == 1) {
+            valid.push_back(ips[i]);
+            valid_index.push_back(i);
+        }
+    }
+    if (valid.size() == ips.size()) {
+        return false;
+    }
+    
+    responses.assign(ips.size(), make_error(SlnatClientError::INVALID, "Invalid IPv6 address format"));
+    if (!valid.empty()) {
+        std::vector<json> fetched = fetch(valid);
+        for (size_t n = 0; n < valid.size(); n++) {
+            responses[valid_index[n]] = std::move(fetched[n]);
+        }
+    }
+    return true;
+}
+
+json SlickNatClient::ping() {
+    if (binary) {
+        return send_binary(SLNAT_CMD_PING, {"::"}).front();
+    }
+    json request = {{"command", "ping"}};
+    return send_request(request);
+}
+
+json SlickNatClient::stats() {
+    if (binary) {
+        return make_error(SlnatClientError::INVALID, "stats is not available over the binary protocol");
+    }
+    json request = {{"command", "stats"}};
+    return send_request(request);
+}
+
+json SlickNatClient::list_mappings(const std::string& prefix, const std::string& interface,
+                                   const std::string& cursor, size_t limit) {
+    if (binary) {
+        return make_error(SlnatClientError::INVALID, "list_mappings is not available over the binary protocol");
+    }
+    json request = {{"command", "list_mappings"}, {"limit", limit}};
+    if (!prefix.empty()) {
+        request["prefix"] = prefix;
+    }
+    if (!interface.empty()) {
+        request["interface"] = interface;
+    }
+    if (!cursor.empty()) {
+        request["cursor"] = cursor;
+    }
+    return send_request(request);
+}
+
+json SlickNatClient::watch(const std::string& prefix, const std::string& interface,
+                           const std::function<bool(const json&)>& on_event) {
+    if (udp || binary || seqpacket) {
+        return make_error(SlnatClientError::INVALID, "watch needs a stream json or ndjson listener");
+    }
+    
+    json request = {{"command", "watch"}};
+    if (!prefix.empty()) {
+        request["prefix"] = prefix;
+    }
+    if (!interface.empty()) {
+        request["interface"] = interface;
+    }
+    
+    // The daemon keeps the connection open and answers with
+    // newline-delimited notifications on either listener type
+    disconnect();
+    json error;
+    if (!ensure_connected(error)) {
+        return error;
+    }
+    if (!send_all(persistent_socket, request.dump() + "\n")) {
+        disconnect();
+        return make_error(SlnatClientError::IO, "Failed to send request");
+    }
+    
+    bool acknowledged = false;
+    std::string line;
+    while (read_line(line)) {
+        json event = parse_response(line);
+        if (!acknowledged && event.contains("error")) {
+            disconnect();
+            return event;
+        }
+        acknowledged = true;
+        if (!on_event(event)) {
+            disconnect();
+            return nullptr;
+        }
+    }
+    
+    // One-shot json listeners close after an unterminated error response
+    json result = make_error(SlnatClientError::IO, "Connection to daemon closed");
+    if (!acknowledged && !recv_buffer.empty()) {
+        result = parse_response(recv_buffer);
+    }
+    disconnect();
+    return result;
+}
+
+json SlickNatClient::make_error(SlnatClientError code, const std::string& message) {
+    return {{"error", message}, {"error_code", static_cast<int>(code)}};
+}
+
+json SlickNatClient::make_resolve_request(const std::string& ip) {
+    return {
+        {"command", "resolve_ip"},
+        {"ip", ip}
+    };
+}
+
+json SlickNatClient::make_get_global_request(const std::string& ip) {
+    return {
+        {"command", "get2kip"},
+        {"ip", ip}
+    };
+}
+
+SlnatClientPool::SlnatClientPool(const std::string& addr, int port, size_t size,
+                                 const std::function<void(SlickNatClient&)>& configure)
+    : server_address(addr), server_port(port), pool_size(std::max<size_t>(size, 1)), configure(configure),
+      created(0), stopping(false) {
+    idle.reserve(pool_size);
+}
+
+SlnatClientPool::~SlnatClientPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    lookup_ready.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+std::vector<json> SlnatClientPool::resolve(const std::vector<std::string>& ips) {
+    return lookup(false, ips);
+}
+
+std::vector<json> SlnatClientPool::get_global(const std::vector<std::string>& ips) {
+    return lookup(true, ips);
+}
+
+json SlnatClientPool::ping() {
+    Lease client(*this);
+    bool reused = client->connected();
+    json pong = client->ping();
+    if (reused && !client->connected()) {
+        pong = client->ping();
+    }
+    return pong;
+}
+
+void SlnatClientPool::resolve_async(const std::vector<std::string>& ips, Callback done) {
+    enqueue(false, ips, std::move(done));
+}
+
+void SlnatClientPool::get_global_async(const std::vector<std::string>& ips, Callback done) {
+    enqueue(true, ips, std::move(done));
+}
+
+std::future<std::vector<json>> SlnatClientPool::resolve_async(const std::vector<std::string>& ips) {
+    return lookup_future(false, ips);
+}
+
+std::future<std::vector<json>> SlnatClientPool::get_global_async(const std::vector<std::string>& ips) {
+    return lookup_future(true, ips);
+}
+
+std::unique_ptr<SlickNatClient> SlnatClientPool::acquire() {
+    std::unique_lock<std::mutex> lock(mutex);
+    client_ready.wait(lock, [this] { return !idle.empty() || created < pool_size; });
+    
+    if (!idle.empty()) {
+        std::unique_ptr<SlickNatClient> client = std::move(idle.back());
+        idle.pop_back();
+        return client;
+    }
+    created++;
+    lock.unlock();
+    
+    try {
+        std::unique_ptr<SlickNatClient> client(new SlickNatClient(server_address, server_port));
+        if (configure) {
+            configure(*client);
+        }
+        return client;
+    } catch (...) {
+        lock.lock();
+        created--;
+        lock.unlock();
+        client_ready.notify_one();
+        throw;
+    }
+}
+
+void SlnatClientPool::release(std::unique_ptr<SlickNatClient> client) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.push_back(std::move(client));
+    }
+    client_ready.notify_one();
+}
+
+std::vector<json> SlnatClientPool::lookup(bool global, const std::vector<std::string>& ips) {
+    if (ips.empty()) {
+        return {};
+    }
+    
+    Lease client(*this);
+    bool reused = client->connected();
+    std::vector<json> results = global ? client->query_global_ips(ips) : client->query_resolve_ips(ips);
+    
+    // The daemon closes connections that sit idle past its read_timeout,
+    // so a pooled connection that turns out to be dead is reopened once
+    if (reused && !client->connected()) {
+        results = global ? client->query_global_ips(ips) : client->query_resolve_ips(ips);
+    }
+    return results;
+}
+
+SlnatClientPool::Lease::Lease(SlnatClientPool& pool)
+    : pool(pool), client(pool.acquire()), exceptions(std::uncaught_exceptions()) {
+}
+
+SlnatClientPool::Lease::~Lease() {
+    if (std::uncaught_exceptions() > exceptions) {
+        client->disconnect();
+    }
+    pool.release(std::move(client));
+}
+
+std::future<std::vector<json>> SlnatClientPool::lookup_future(bool global, const std::vector<std::string>& ips) {
+    auto promise = std::make_shared<std::promise<std::vector<json>>>();
+    std::future<std::vector<json>> future = promise->get_future();
+    enqueue(global, ips, [promise](std::vector<json> results) {
+        promise->set_value(std::move(results));
+    });
+    return future;
+}
+
+void SlnatClientPool::enqueue(bool global, const std::vector<std::string>& ips, Callback done) {
+    if (ips.empty()) {
+        done({});
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Worker threads start with the first asynchronous lookup
+        if (workers.empty()) {
+            for (size_t i = 0; i < pool_size; i++) {
+                workers.emplace_back(&SlnatClientPool::run_worker, this);
+            }
+        }
+        queue.push_back({global, ips, std::move(done)});
+    }
+    lookup_ready.notify_one();
+}
+
+void SlnatClientPool::run_worker() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        lookup_ready.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            return;
+        }
+        
+        // Take consecutive lookups of the same kind, up to the merge limit
+        std::vector<Lookup> batch;
+        std::vector<std::string> ips;
+        bool global = queue.front().global;
+        while (!queue.empty() && queue.front().global == global &&
+               (batch.empty() || ips.size() + queue.front().ips.size() <= MAX_MERGED_ADDRESSES)) {
+            ips.insert(ips.end(), queue.front().ips.begin(), queue.front().ips.end());
+            batch.push_back(std::move(queue.front()));
+            queue.pop_front();
+        }
+        lock.unlock();
+        
+        std::vector<json> results;
+        try {
+            results = lookup(global, ips);
+        } catch (const std::exception& e) {
+            results.assign(ips.size(), SlickNatClient::make_error(SlnatClientError::IO,
+                                                                  std::string("Lookup failed: ") + e.what()));
+        }
+        
+        size_t offset = 0;
+        for (auto& pending : batch) {
+            std::vector<json> part(results.begin() + offset, results.begin() + offset + pending.ips.size());
+            offset += pending.ips.size();
+            try {
+                pending.done(std::move(part));
+            } catch (...) {
+            }
+        }
+        
+        lock.lock();
+    }
+}
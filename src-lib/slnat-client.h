@@ -0,0 +1,335 @@
+// SlickNat client library, C++ interface
+//
+// SlickNatClient talks to one daemon over any of its listener types (json,
+// ndjson, binary, udp, seqpacket) or reads its shared-memory export, and is
+// what slnatc is built on. SlnatClientPool shares a fixed set of them
+// between threads and adds asynchronous lookups. Both are compiled into
+// libslnat; the stable interface for other programs is the C API in
+// slnat.h, since this one exposes nlohmann::json.
+
+#ifndef SLNAT_CLIENT_H
+#define SLNAT_CLIENT_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <nlohmann/json.hpp>
+#include "../src-common/slnat-binary.h"
+#include "../src-common/slnat-shm.h"
+
+// Kind of failure behind an error response the client produced itself,
+// stored in its "error_code" field. Errors sent by the daemon carry none.
+enum class SlnatClientError {
+    CONNECT = 1,    // No daemon or shared-memory export to talk to
+    INVALID,        // Bad address or a request the transport cannot carry
+    TIMEOUT,
+    IO,             // Connection failed while sending or receiving
+    PROTOCOL        // Reply that does not parse or match the request
+};
+
+// Not thread-safe: use one client per thread, or a SlnatClientPool
+class SlickNatClient {
+public:
+    using json = nlohmann::json;
+
+private:
+    std::string server_address;
+    int server_port;
+    // Set when server_address is "unix:/path"
+    std::string unix_path;
+    // One message per request on a unix listener with "seqpacket"
+    bool seqpacket;
+    
+    // Persistent newline-delimited mode (daemon listener with "ndjson")
+    bool persistent;
+    // Fixed-size binary records (daemon listener with "binary")
+    bool binary;
+    int persistent_socket;
+    std::string recv_buffer;
+    // SO_RCVTIMEO/SO_SNDTIMEO for stream and seqpacket sockets, 0 for none
+    int io_timeout_ms;
+    
+    // One datagram per request (daemon listener with "udp")
+    bool udp;
+    int udp_timeout_ms;
+    int udp_retries;
+    
+    // Binary records per datagram or seqpacket message, keeping replies
+    // under the UDP size limit
+    static const size_t MAX_MESSAGE_RECORDS = 1024;
+    // Addresses per JSON batch request sent over UDP or seqpacket, for the
+    // same reason
+    static const size_t MAX_DATAGRAM_BATCH = 256;
+    // Addresses per JSON batch request on stream connections, keeping the
+    // request under the daemon's 1 MiB limit
+    static const size_t MAX_STREAM_BATCH = 16384;
+    
+    // Results shared by every slnatc run through a file under /run. Entries
+    // belong to one table generation; within the TTL they are used as is,
+    // afterwards a ping confirms the generation before they are reused.
+    int cache_ttl_ms;
+    std::string cache_path;
+    json cache;
+    
+    static const size_t MAX_CACHE_ENTRIES = 256;
+    
+    // Lookups straight from the daemon's shared-memory export
+    std::unique_ptr<SlnatShmReader> shm;
+    std::string shm_path;
+    
+    int connect_to_daemon(json& error, int type = SOCK_STREAM);
+    
+    bool send_all(int client_socket, const std::string& data);
+    
+    // Writes a pipeline of requests to the persistent socket, reading the
+    // answers that arrive meanwhile into recv_buffer. The daemon stops
+    // reading a connection while its output is queued, so sending a large
+    // pipeline without reading would stall once both directions fill up.
+    bool send_pipeline(const std::string& data);
+    
+    bool fill_recv_buffer();
+    
+    bool read_line(std::string& line);
+    
+    // Error for a failed recv(), telling a timeout apart from a closed or
+    // broken connection. Must be called before errno is overwritten.
+    static json receive_error();
+    
+    // Pipelines one binary request per address and converts the answers to
+    // the same JSON shape the daemon's JSON API returns
+    std::vector<json> send_binary(uint8_t command, const std::vector<std::string>& ips);
+    
+    // Sends one datagram and waits for the reply, resending up to
+    // udp_retries times when nothing arrives within udp_timeout_ms
+    bool udp_exchange(const std::string& payload, std::string& reply, json& error);
+    
+    // One request message and one reply message over the persistent
+    // SOCK_SEQPACKET connection; the reply is sized with MSG_PEEK first
+    bool message_exchange(const std::string& payload, std::string& reply, json& error);
+    
+    static json binary_to_json(uint8_t command, const std::string& ip, const SlnatBinaryResponse& response);
+    static void add_mapped_address(uint8_t command, const std::string& ip, const SlnatBinaryResponse& response,
+                                   json& result);
+    
+    bool ensure_connected(json& error);
+    
+    std::vector<json> send_batch(const std::string& command, const std::vector<std::string>& ips);
+    
+    static int64_t now_ms();
+    
+    // A missing or unreadable cache file is just an empty cache
+    void load_cache();
+    
+    // Written to a temporary file and renamed so concurrent runs never see
+    // a partial cache
+    void save_cache();
+    
+    // Confirms cached entries still match the daemon's table once the TTL
+    // has passed. Returns false when the daemon could not be asked.
+    bool revalidate_cache();
+    
+    // Answers what it can from the cache and fetches the rest
+    std::vector<json> cached_lookup(const std::string& command, const std::vector<std::string>& ips,
+                                    const std::function<std::vector<json>(const std::vector<std::string>&)>& fetch);
+    
+    // Answers malformed addresses locally, so they fail with a typed error
+    // on every transport, and fetches the rest. Returns false, leaving
+    // responses alone, when every address is well-formed.
+    bool answer_invalid(const std::vector<std::string>& ips, std::vector<json>& responses,
+                        const std::function<std::vector<json>(const std::vector<std::string>&)>& fetch);
+    
+    // Same response shapes as the daemon's batch results
+    std::vector<json> shm_lookup(bool global_only, const std::vector<std::string>& ips);
+    
+    json parse_response(const std::string& data);
+
+public:
+    // addr is an IPv6 address or "unix:/path" for a unix listener
+    SlickNatClient(const std::string& addr, int port = 7001);
+    
+    ~SlickNatClient();
+    
+    std::string daemon_name() const;
+    
+    // Keep one connection open and send newline-delimited requests over it
+    void set_persistent(bool enable);
+    
+    // Use the compact binary protocol over one persistent connection
+    void set_binary(bool enable);
+    
+    // Send each request (or batch) as one message over a unix SOCK_SEQPACKET
+    // connection that stays open
+    void set_seqpacket(bool enable);
+    
+    // Send each request (or batch) as one datagram and retry on timeout
+    void set_udp(bool enable, int timeout_ms = 1000, int retries = 2);
+    
+    // Reuse results for up to ttl_ms, then revalidate them against the
+    // daemon's generation. The cache file lives in /run/slnatc for root and
+    // in $XDG_RUNTIME_DIR/slnatc otherwise; without either caching is off.
+    void set_cache(int ttl_ms);
+    
+    // Answer get2kip/resolve from the daemon's shared-memory export on this
+    // host instead of over the network
+    void set_shm(const std::string& path);
+    
+    // Give up on a daemon that has not answered within timeout_ms
+    void set_timeout(int timeout_ms);
+    
+    // Whether a persistent connection is currently open
+    bool connected() const;
+    
+    void disconnect();
+    
+    json send_request(const json& request);
+    
+    // Writes all requests before reading any response; responses come back
+    // in request order. Without persistent mode each request is sent on its
+    // own connection.
+    std::vector<json> send_pipelined(const std::vector<json>& requests);
+    
+    json resolve_ip(const std::string& ip);
+    
+    json get_global_ip(const std::string& ip);
+    
+    // One round trip for many addresses; returns one result per input
+    std::vector<json> resolve_batch(const std::vector<std::string>& ips);
+    
+    std::vector<json> get_global_batch(const std::vector<std::string>& ips);
+    
+    // Many addresses at once, answered from the cache where possible
+    std::vector<json> resolve_ips(const std::vector<std::string>& ips);
+    
+    std::vector<json> get_global_ips(const std::vector<std::string>& ips);
+    
+    // Many addresses over whichever transport is configured: binary records,
+    // pipelined NDJSON requests, or a single batch request
+    std::vector<json> query_resolve_ips(const std::vector<std::string>& ips);
+    
+    std::vector<json> query_global_ips(const std::vector<std::string>& ips);
+    
+    json ping();
+    
+    json stats();
+    
+    // One page of the daemon's mappings, sorted by internal prefix. An empty
+    // cursor starts at the beginning; the response carries "next_cursor"
+    // while more mappings follow.
+    json list_mappings(const std::string& prefix, const std::string& interface, const std::string& cursor,
+                       size_t limit);
+    
+    // Subscribes to mapping changes and passes the acknowledgement and then
+    // every notification to on_event until it returns false. Returns the
+    // error that ended the watch, or null when on_event stopped it.
+    json watch(const std::string& prefix, const std::string& interface,
+               const std::function<bool(const json&)>& on_event);
+    
+    static json make_error(SlnatClientError code, const std::string& message);
+    
+    static json make_resolve_request(const std::string& ip);
+    
+    static json make_get_global_request(const std::string& ip);
+};
+
+// A fixed number of SlickNatClients shared between threads. Synchronous
+// calls borrow an idle client for the duration of the call. Asynchronous
+// lookups are queued and answered by up to one thread per client, which
+// merges queued lookups of the same kind into a single round trip.
+class SlnatClientPool {
+public:
+    using json = nlohmann::json;
+    // Called on a pool thread with one result per address
+    using Callback = std::function<void(std::vector<json>)>;
+    
+    // configure is applied to each client when it is first needed
+    SlnatClientPool(const std::string& addr, int port, size_t size,
+                    const std::function<void(SlickNatClient&)>& configure = nullptr);
+    
+    // Answers every queued lookup before returning
+    ~SlnatClientPool();
+    
+    std::vector<json> resolve(const std::vector<std::string>& ips);
+    
+    std::vector<json> get_global(const std::vector<std::string>& ips);
+    
+    json ping();
+    
+    // Exceptions thrown by done are discarded
+    void resolve_async(const std::vector<std::string>& ips, Callback done);
+    
+    void get_global_async(const std::vector<std::string>& ips, Callback done);
+    
+    std::future<std::vector<json>> resolve_async(const std::vector<std::string>& ips);
+    
+    std::future<std::vector<json>> get_global_async(const std::vector<std::string>& ips);
+
+private:
+    struct Lookup {
+        bool global;
+        std::vector<std::string> ips;
+        Callback done;
+    };
+    
+    // Addresses per merged round trip
+    static const size_t MAX_MERGED_ADDRESSES = 1024;
+    
+    // A client borrowed for one call and handed back when the call ends,
+    // also by an exception. It is disconnected in that case, since its
+    // connection may still hold answers nobody read.
+    class Lease {
+    public:
+        explicit Lease(SlnatClientPool& pool);
+        ~Lease();
+        
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        
+        SlickNatClient* operator->() const {
+            return client.get();
+        }
+    
+    private:
+        SlnatClientPool& pool;
+        std::unique_ptr<SlickNatClient> client;
+        int exceptions;                 // std::uncaught_exceptions() when borrowed
+    };
+    
+    std::string server_address;
+    int server_port;
+    size_t pool_size;
+    std::function<void(SlickNatClient&)> configure;
+    
+    std::mutex mutex;
+    std::condition_variable client_ready;
+    std::condition_variable lookup_ready;
+    std::vector<std::unique_ptr<SlickNatClient>> idle;
+    size_t created;
+    std::deque<Lookup> queue;
+    std::vector<std::thread> workers;
+    bool stopping;
+    
+    // Blocks while every client is in use. A client that cannot be
+    // created gives its slot back before the exception propagates.
+    std::unique_ptr<SlickNatClient> acquire();
+    
+    // Never throws: idle has room for every client from the start
+    void release(std::unique_ptr<SlickNatClient> client);
+    
+    std::vector<json> lookup(bool global, const std::vector<std::string>& ips);
+    
+    std::future<std::vector<json>> lookup_future(bool global, const std::vector<std::string>& ips);
+    
+    void enqueue(bool global, const std::vector<std::string>& ips, Callback done);
+    
+    void run_worker();
+};
+
+#endif // SLNAT_CLIENT_H
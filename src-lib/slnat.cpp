@@ -0,0 +1,304 @@
+// SlickNat client library, C interface
+//
+// Thin wrappers over SlnatClientPool. Nothing may throw across the C
+// boundary, so every entry point catches and maps exceptions to a status.
+
+#include "slnat.h"
+#include "slnat-client.h"
+#include <cstring>
+#include <new>
+
+using json = nlohmann::json;
+
+struct slnat_client {
+    std::string address;
+    int port;
+    int transport;
+    size_t pool_size;
+    int timeout_ms;
+    
+    // Created on first use, after which the settings are fixed
+    std::mutex mutex;
+    std::unique_ptr<SlnatClientPool> pool;
+};
+
+static const int DEFAULT_POOL_SIZE = 4;
+static const int DEFAULT_TIMEOUT_MS = 5000;
+static const int UDP_RETRIES = 2;
+
+static SlnatClientPool* client_pool(slnat_client* client) {
+    std::lock_guard<std::mutex> lock(client->mutex);
+    if (!client->pool) {
+        int transport = client->transport;
+        int timeout_ms = client->timeout_ms;
+        client->pool.reset(new SlnatClientPool(client->address, client->port, client->pool_size,
+                                               [transport, timeout_ms](SlickNatClient& pooled) {
+            pooled.set_timeout(timeout_ms);
+            switch (transport) {
+                case SLNAT_TRANSPORT_NDJSON:    pooled.set_persistent(true); break;
+                case SLNAT_TRANSPORT_BINARY:    pooled.set_binary(true); break;
+                case SLNAT_TRANSPORT_UDP:       pooled.set_udp(true, timeout_ms, UDP_RETRIES); break;
+                case SLNAT_TRANSPORT_SEQPACKET: pooled.set_seqpacket(true); break;
+            }
+        }));
+    }
+    return client->pool.get();
+}
+
+// Settings can only change before the pool exists
+static int configure(slnat_client* client, const std::function<void()>& apply) {
+    if (!client) {
+        return SLNAT_ERR_INVALID;
+    }
+    std::lock_guard<std::mutex> lock(client->mutex);
+    if (client->pool) {
+        return SLNAT_ERR_INVALID;
+    }
+    apply();
+    return SLNAT_OK;
+}
+
+static void copy_string(char* dest, size_t size, const std::string& src) {
+    size_t length = std::min(src.size(), size - 1);
+    memcpy(dest, src.data(), length);
+    dest[length] = '\0';
+}
+
+// Errors the client produced carry their kind; any other error is the
+// daemon refusing a request this library should not have sent
+static int error_status(const json& response) {
+    switch (static_cast<SlnatClientError>(response.value("error_code", 0))) {
+        case SlnatClientError::CONNECT:  return SLNAT_ERR_CONNECT;
+        case SlnatClientError::INVALID:  return SLNAT_ERR_INVALID;
+        case SlnatClientError::TIMEOUT:  return SLNAT_ERR_TIMEOUT;
+        case SlnatClientError::IO:       return SLNAT_ERR_IO;
+        default:                         return SLNAT_ERR_PROTOCOL;
+    }
+}
+
+// Converts one lookup response in the daemon's JSON shape
+static void fill_result(const json& response, slnat_result* result) {
+    memset(result, 0, sizeof(*result));
+    if (!response.is_object()) {
+        result->status = SLNAT_ERR_PROTOCOL;
+        copy_string(result->error, sizeof(result->error), "Malformed response");
+        return;
+    }
+    
+    std::string status = response.value("status", "");
+    result->generation = response.value("generation", uint64_t(0));
+    if (response.value("stale", false)) {
+        result->flags |= SLNAT_RESULT_STALE;
+    }
+    
+    if (status == "success") {
+        std::string mapped;
+        if (response.contains("global_ip")) {
+            mapped = response.value("global_ip", "");
+        } else if (response.contains("external_ip")) {
+            mapped = response.value("internal_ip", "");
+            result->flags |= SLNAT_RESULT_EXTERNAL;
+        } else {
+            mapped = response.value("public_ip", "");
+        }
+        result->status = SLNAT_OK;
+        copy_string(result->mapped, sizeof(result->mapped), mapped);
+        copy_string(result->interface, sizeof(result->interface), response.value("interface", ""));
+        return;
+    }
+    
+    std::string error = response.value("error", "");
+    if (status == "not_found") {
+        result->status = SLNAT_NOT_FOUND;
+    } else if (status == "busy") {
+        result->status = SLNAT_ERR_BUSY;
+    } else {
+        if (error.empty()) {
+            error = "Unexpected response";
+        }
+        result->status = error_status(response);
+    }
+    copy_string(result->error, sizeof(result->error), error);
+}
+
+// Shared by the blocking calls; results must hold count entries
+static int lookup(slnat_client* client, bool global, const char* const* ips, size_t count, slnat_result* results) {
+    if (!client || (count > 0 && (!ips || !results))) {
+        return SLNAT_ERR_INVALID;
+    }
+    try {
+        std::vector<std::string> addresses;
+        for (size_t i = 0; i < count; i++) {
+            addresses.push_back(ips[i] ? ips[i] : "");
+        }
+        
+        SlnatClientPool* pool = client_pool(client);
+        std::vector<json> responses = global ? pool->get_global(addresses) : pool->resolve(addresses);
+        
+        int status = SLNAT_OK;
+        for (size_t i = 0; i < count; i++) {
+            fill_result(responses[i], &results[i]);
+            if (results[i].status < 0 && status == SLNAT_OK) {
+                status = results[i].status;
+            }
+        }
+        return status;
+    } catch (const std::bad_alloc&) {
+        return SLNAT_ERR_NOMEM;
+    } catch (const std::exception&) {
+        return SLNAT_ERR_IO;
+    }
+}
+
+static int lookup_async(slnat_client* client, bool global, const char* const* ips, size_t count,
+                        slnat_callback callback, void* user_data) {
+    if (!client || !callback || (count > 0 && !ips)) {
+        return SLNAT_ERR_INVALID;
+    }
+    try {
+        std::vector<std::string> addresses;
+        for (size_t i = 0; i < count; i++) {
+            addresses.push_back(ips[i] ? ips[i] : "");
+        }
+        
+        auto done = [callback, user_data](std::vector<json> responses) {
+            std::vector<slnat_result> results(responses.size());
+            for (size_t i = 0; i < responses.size(); i++) {
+                fill_result(responses[i], &results[i]);
+            }
+            callback(user_data, results.data(), results.size());
+        };
+        
+        SlnatClientPool* pool = client_pool(client);
+        if (global) {
+            pool->get_global_async(addresses, done);
+        } else {
+            pool->resolve_async(addresses, done);
+        }
+        return SLNAT_OK;
+    } catch (const std::bad_alloc&) {
+        return SLNAT_ERR_NOMEM;
+    } catch (const std::exception&) {
+        return SLNAT_ERR_IO;
+    }
+}
+
+
+extern "C" {
+
+slnat_client* slnat_client_new(const char* address, int port) {
+    if (!address) {
+        return nullptr;
+    }
+    try {
+        slnat_client* client = new slnat_client;
+        client->address = address;
+        client->port = port;
+        client->transport = SLNAT_TRANSPORT_JSON;
+        client->pool_size = DEFAULT_POOL_SIZE;
+        client->timeout_ms = DEFAULT_TIMEOUT_MS;
+        return client;
+    } catch (const std::exception&) {
+        return nullptr;
+    }
+}
+
+void slnat_client_free(slnat_client* client) {
+    delete client;
+}
+
+int slnat_set_transport(slnat_client* client, int transport) {
+    if (transport < SLNAT_TRANSPORT_JSON || transport > SLNAT_TRANSPORT_SEQPACKET) {
+        return SLNAT_ERR_INVALID;
+    }
+    return configure(client, [&] { client->transport = transport; });
+}
+
+int slnat_set_pool_size(slnat_client* client, size_t size) {
+    if (size == 0) {
+        return SLNAT_ERR_INVALID;
+    }
+    return configure(client, [&] { client->pool_size = size; });
+}
+
+int slnat_set_timeout(slnat_client* client, int timeout_ms) {
+    if (timeout_ms <= 0) {
+        return SLNAT_ERR_INVALID;
+    }
+    return configure(client, [&] { client->timeout_ms = timeout_ms; });
+}
+
+int slnat_resolve(slnat_client* client, const char* ip, slnat_result* result) {
+    if (!ip || !result) {
+        return SLNAT_ERR_INVALID;
+    }
+    int status = lookup(client, false, &ip, 1, result);
+    return status < 0 ? status : result->status;
+}
+
+int slnat_get2kip(slnat_client* client, const char* ip, slnat_result* result) {
+    if (!ip || !result) {
+        return SLNAT_ERR_INVALID;
+    }
+    int status = lookup(client, true, &ip, 1, result);
+    return status < 0 ? status : result->status;
+}
+
+int slnat_resolve_batch(slnat_client* client, const char* const* ips, size_t count, slnat_result* results) {
+    return lookup(client, false, ips, count, results);
+}
+
+int slnat_get2kip_batch(slnat_client* client, const char* const* ips, size_t count, slnat_result* results) {
+    return lookup(client, true, ips, count, results);
+}
+
+int slnat_resolve_async(slnat_client* client, const char* const* ips, size_t count,
+                        slnat_callback callback, void* user_data) {
+    return lookup_async(client, false, ips, count, callback, user_data);
+}
+
+int slnat_get2kip_async(slnat_client* client, const char* const* ips, size_t count,
+                        slnat_callback callback, void* user_data) {
+    return lookup_async(client, true, ips, count, callback, user_data);
+}
+
+int slnat_ping(slnat_client* client, uint64_t* generation) {
+    if (!client) {
+        return SLNAT_ERR_INVALID;
+    }
+    try {
+        json pong = client_pool(client)->ping();
+        if (pong.value("status", "") != "pong") {
+            return pong.value("status", "") == "busy" ? SLNAT_ERR_BUSY : error_status(pong);
+        }
+        if (generation) {
+            *generation = pong.value("generation", uint64_t(0));
+        }
+        return SLNAT_OK;
+    } catch (const std::bad_alloc&) {
+        return SLNAT_ERR_NOMEM;
+    } catch (const std::exception&) {
+        return SLNAT_ERR_IO;
+    }
+}
+
+const char* slnat_strerror(int status) {
+    switch (status) {
+        case SLNAT_OK:           return "Success";
+        case SLNAT_NOT_FOUND:    return "No matching mapping";
+        case SLNAT_ERR_INVALID:  return "Invalid argument";
+        case SLNAT_ERR_CONNECT:  return "Cannot connect to daemon";
+        case SLNAT_ERR_IO:       return "Connection to daemon failed";
+        case SLNAT_ERR_TIMEOUT:  return "Timed out waiting for daemon";
+        case SLNAT_ERR_BUSY:     return "Daemon is busy";
+        case SLNAT_ERR_PROTOCOL: return "Unexpected response from daemon";
+        case SLNAT_ERR_NOMEM:    return "Out of memory";
+        default:                 return "Unknown status";
+    }
+}
+
+const char* slnat_version(void) {
+    return "1.0";
+}
+
+}
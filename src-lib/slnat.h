@@ -0,0 +1,123 @@
+// SlickNat client library
+//
+// C interface to a SlickNat daemon, usable from C, C++ and anything with a
+// C FFI. A client keeps a pool of persistent connections (or one socket
+// per request for the json and udp transports) and is safe to share
+// between threads. Lookups come synchronously, in batches answered with a
+// single round trip, or asynchronously through a callback that runs on
+// one of the client's threads.
+//
+// Link with -lslnat (pkg-config slnat).
+
+#ifndef SLNAT_H
+#define SLNAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SLNAT_API __attribute__((visibility("default")))
+
+#define SLNAT_VERSION_MAJOR 1
+#define SLNAT_VERSION_MINOR 0
+
+// Status codes; negative values are errors
+#define SLNAT_OK 0
+#define SLNAT_NOT_FOUND 1
+#define SLNAT_ERR_INVALID -1
+#define SLNAT_ERR_CONNECT -2
+#define SLNAT_ERR_IO -3
+#define SLNAT_ERR_TIMEOUT -4
+#define SLNAT_ERR_BUSY -5
+#define SLNAT_ERR_PROTOCOL -6
+#define SLNAT_ERR_NOMEM -7
+
+// Must match the type of the daemon listener being used
+#define SLNAT_TRANSPORT_JSON 0
+#define SLNAT_TRANSPORT_NDJSON 1
+#define SLNAT_TRANSPORT_BINARY 2
+#define SLNAT_TRANSPORT_UDP 3
+#define SLNAT_TRANSPORT_SEQPACKET 4
+
+// Set when a resolve matched the address as an external (public) one;
+// mapped then holds the internal address
+#define SLNAT_RESULT_EXTERNAL 0x1
+// Set when the answer came from the daemon's startup snapshot, before it
+// read the current mappings
+#define SLNAT_RESULT_STALE 0x2
+
+typedef struct slnat_client slnat_client;
+
+typedef struct slnat_result {
+    int status;
+    uint32_t flags;
+    // Mapping table generation the answer came from
+    uint64_t generation;
+    // The other side of the mapping, as text
+    char mapped[46];
+    char interface[16];
+    // Set for errors, empty otherwise
+    char error[128];
+} slnat_result;
+
+// results holds count entries, in request order, and is only valid during
+// the call
+typedef void (*slnat_callback)(void* user_data, const slnat_result* results, size_t count);
+
+// address is an IPv6 address or "unix:/path"; port is ignored for unix
+// sockets. Returns NULL when out of memory.
+SLNAT_API slnat_client* slnat_client_new(const char* address, int port);
+
+// Waits for pending asynchronous lookups and runs their callbacks first
+SLNAT_API void slnat_client_free(slnat_client* client);
+
+// The settings below fail with SLNAT_ERR_INVALID once the client has been
+// used. Defaults: SLNAT_TRANSPORT_JSON, 4 connections, 5000 ms.
+SLNAT_API int slnat_set_transport(slnat_client* client, int transport);
+
+SLNAT_API int slnat_set_pool_size(slnat_client* client, size_t size);
+
+// Per send/receive on a connection; per attempt for SLNAT_TRANSPORT_UDP
+SLNAT_API int slnat_set_timeout(slnat_client* client, int timeout_ms);
+
+// Looks up either side of a mapping. Returns result->status.
+SLNAT_API int slnat_resolve(slnat_client* client, const char* ip, slnat_result* result);
+
+// Looks up the global address for an internal one. Returns result->status.
+SLNAT_API int slnat_get2kip(slnat_client* client, const char* ip, slnat_result* result);
+
+// Fill results[0..count). Return SLNAT_OK when every address was answered
+// (found or not), otherwise the status of the first failed one. Batches of
+// any size are accepted: they are pipelined on ndjson and binary
+// connections and split into requests the daemon accepts on the others.
+// The timeout applies to each step of the exchange, not the whole batch.
+SLNAT_API int slnat_resolve_batch(slnat_client* client, const char* const* ips, size_t count,
+                                  slnat_result* results);
+
+SLNAT_API int slnat_get2kip_batch(slnat_client* client, const char* const* ips, size_t count,
+                                  slnat_result* results);
+
+// Queue a lookup and return immediately; callback runs exactly once when
+// SLNAT_OK is returned. Queued lookups are merged into shared round trips.
+SLNAT_API int slnat_resolve_async(slnat_client* client, const char* const* ips, size_t count,
+                                  slnat_callback callback, void* user_data);
+
+SLNAT_API int slnat_get2kip_async(slnat_client* client, const char* const* ips, size_t count,
+                                  slnat_callback callback, void* user_data);
+
+// generation may be NULL
+SLNAT_API int slnat_ping(slnat_client* client, uint64_t* generation);
+
+SLNAT_API const char* slnat_strerror(int status);
+
+// Library version as "major.minor"
+SLNAT_API const char* slnat_version(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SLNAT_H